@@ -1,17 +1,26 @@
 #include "AppDrawer.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <fcntl.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
-#include <thread>
+#include <unistd.h>
 
+#include "Epochs.h"
+#include "EventChannel.h"
+#include "EventRing.h"
+#include "Message.h"
+#include "Reactor.h"
 #include "RudeDrawer.h"
 #include "Window.h"
 
@@ -21,30 +30,263 @@ bool fileExists(std::string const& name) noexcept(true)
     return ::stat(name.c_str(), &buffer) == 0;
 }
 
-Client::Client(int sockfd) noexcept(true)
+Client::Client(AppDrawer* appdrawer, Reactor* reactor, int sockfd) noexcept(true)
+    : ReactorHandler(reactor->pickLoop())
 {
-    this->m_sockfd = sockfd;
+    m_appdrawer = appdrawer;
+    m_reactor = reactor;
+    m_source = ReactorSource { this, sockfd };
+    m_watching = EPOLLIN;
 }
 
-ClientResult Client::receiveOrFail(void* data, int n) noexcept(true)
+bool Client::start() noexcept(true)
 {
-    int numBytesReceived = recv(m_sockfd, data, n, 0);
-    if (numBytesReceived < 0) {
-        std::cerr << "ERROR: could not receive bytes from socket: "
-                  << strerror(errno) << "\n";
-        return CLIENT_ERR;
-    } else if (numBytesReceived == 0) {
-        std::cout << "[INFO] Connection closed by client\n";
-        return CLIENT_CLOSED;
+    return m_reactor->add(&m_source, m_watching);
+}
+
+void Client::onReady(ReactorSource*, uint32_t events) noexcept(true)
+{
+    if (events & EPOLLOUT) {
+        if (!flushNonBlocking(m_source.fd, m_output, &m_outputFds)) {
+            std::cerr << "ERROR: could not send data to the client: "
+                      << strerror(errno) << "\n";
+            close();
+            return;
+        }
+    }
+
+    auto result = CLIENT_OK;
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        result = receive();
+
+    // Commands sent right before hanging up are still handled
+    handleCommands();
+    if (m_retired)
+        return;
+    if (result != CLIENT_OK) {
+        close();
+        return;
+    }
+
+    rearm();
+}
+
+// The most bytes read from a client at once, so that one client sending
+// commands without pause does not starve the others
+#define CLIENT_RECEIVE_MAX (64 * 1024)
+
+ClientResult Client::receive() noexcept(true)
+{
+    size_t received = 0;
+    while (received < CLIENT_RECEIVE_MAX) {
+        auto size = m_input.size();
+        m_input.resize(size + sizeof(RudeDrawerCommand));
+        int numBytesReceived = recv(m_source.fd, m_input.data() + size, sizeof(RudeDrawerCommand), 0);
+        m_input.resize(size + std::max(numBytesReceived, 0));
+
+        if (numBytesReceived < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            std::cerr << "ERROR: could not receive bytes from socket: "
+                      << strerror(errno) << "\n";
+            return CLIENT_ERR;
+        } else if (numBytesReceived == 0) {
+            std::cout << "[INFO] Connection closed by client\n";
+            return CLIENT_CLOSED;
+        }
+        received += numBytesReceived;
     }
     return CLIENT_OK;
 }
 
-ClientResult Client::sendOrFail(void* data, int n) noexcept(true)
+size_t Client::negotiate() noexcept(true)
+{
+    uint32_t magic;
+    if (m_input.size() < sizeof(magic))
+        return 0;
+    std::memcpy(&magic, m_input.data(), sizeof(magic));
+    if (magic != PROTOCOL_MAGIC) {
+        m_version = 1;
+        return 0;
+    }
+
+    RudeDrawerHello hello;
+    if (m_input.size() < sizeof(hello))
+        return 0;
+    std::memcpy(&hello, m_input.data(), sizeof(hello));
+
+    m_version = std::clamp(hello.version, (uint32_t)1, (uint32_t)PROTOCOL_VERSION);
+    std::cout << "[INFO] Client speaks version " << m_version << " of the protocol\n";
+
+    hello.version = m_version;
+    if (!sendNonBlocking(m_source.fd, m_output, &hello, sizeof(hello))) {
+        std::cerr << "ERROR: could not send data to the client: "
+                  << strerror(errno) << "\n";
+        close();
+    }
+    return sizeof(hello);
+}
+
+long Client::handleMessage(uint8_t const* data, size_t size) noexcept(true)
 {
-    if (send(m_sockfd, data, n, 0) < 0) {
+    RudeDrawerCommand command;
+    if (m_version == 1) {
+        if (size < sizeof(RudeDrawerCommand))
+            return 0;
+        std::memcpy(&command, data, sizeof(RudeDrawerCommand));
+        m_requestId = 0;
+
+        std::cout << "[INFO] Received data\n";
+        m_appdrawer->handleCommand(*this, command);
+        return sizeof(RudeDrawerCommand);
+    }
+
+    RudeDrawerMessageHeader header;
+    if (size < sizeof(header))
+        return 0;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.length > MESSAGE_PAYLOAD_MAX) {
+        std::cerr << "ERROR: message of " << header.length << " bytes is too large\n";
+        return -1;
+    }
+    if (size < sizeof(header) + header.length)
+        return 0;
+
+    std::cout << "[INFO] Received data\n";
+    m_requestId = header.requestId;
+    auto payload = data + sizeof(header);
+    if (header.kind == RDCMD_BATCH) {
+        m_appdrawer->handleBatch(*this, payload, header.length);
+        return sizeof(header) + header.length;
+    }
+
+    if (!decodeCommand(header, payload, command)) {
+        std::cerr << "ERROR: malformed command `" << header.kind << "`\n";
+        // The response to an invalid command says so
+        command.kind = (RudeDrawerCommandKind)-1;
+    }
+    m_appdrawer->handleCommand(*this, command);
+    return sizeof(header) + header.length;
+}
+
+void Client::handleCommands() noexcept(true)
+{
+    size_t offset = 0;
+    if (m_version == 0)
+        offset = negotiate();
+
+    while (m_version != 0 && !m_retired && !m_parked && m_output.empty()) {
+        auto size = handleMessage(m_input.data() + offset, m_input.size() - offset);
+        if (size < 0) {
+            close();
+            return;
+        }
+        if (size == 0)
+            break;
+        offset += size;
+    }
+    m_input.erase(m_input.begin(), m_input.begin() + offset);
+}
+
+void Client::watch(uint32_t events) noexcept(true)
+{
+    if (events == m_watching)
+        return;
+    m_watching = events;
+    m_reactor->modify(&m_source, events);
+}
+
+void Client::rearm() noexcept(true)
+{
+    // Parked, only a hangup is reported
+    if (m_parked)
+        watch(0);
+    else
+        watch(m_output.empty() ? EPOLLIN : EPOLLOUT);
+}
+
+void Client::park() noexcept(true)
+{
+    m_parked = true;
+    m_parkedRequestId = m_requestId;
+    m_reactor->hold(this);
+}
+
+void Client::resume(std::function<void()> finish) noexcept(false)
+{
+    m_reactor->post(this, [this, finish] {
+        m_parked = false;
+        m_requestId = m_parkedRequestId;
+        finish();
+        if (m_retired)
+            return;
+        handleCommands();
+        if (!m_retired)
+            rearm();
+    });
+}
+
+void Client::close() noexcept(true)
+{
+    m_reactor->remove(&m_source);
+    ::close(m_source.fd);
+    for (auto fd : m_outputFds) {
+        ::close(fd);
+    }
+    m_outputFds.clear();
+    m_reactor->retire(this);
+}
+
+ClientResult Client::respondOrFail(RudeDrawerResponse const& response) noexcept(true)
+{
+    if (m_retired)
+        return CLIENT_CLOSED;
+
+    // Descriptors can be closed before they are sent
+    int fds[2] = { -1, -1 };
+    if (response.errorKind == RDERROR_OK) {
+        if (response.kind == RDRESP_SHM_NAME || response.kind == RDRESP_SURFACE)
+            fds[0] = response.shmFd;
+        if (response.kind == RDRESP_SURFACE)
+            fds[1] = response.eventFd;
+    }
+    for (auto fd : fds) {
+        if (fd == -1)
+            continue;
+        auto copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (copy == -1) {
+            std::cerr << "ERROR: could not duplicate file descriptor: "
+                      << strerror(errno) << "\n";
+            close();
+            return CLIENT_ERR;
+        }
+        m_outputFds.push_back(copy);
+    }
+
+    if (m_batching) {
+        auto addsWindow = response.kind == RDRESP_WINID || response.kind == RDRESP_SURFACE;
+        if (addsWindow && response.errorKind == RDERROR_OK)
+            m_batchWindowId = response.windowId;
+        encodeResponse(response, m_requestId, m_batchResponses);
+        return CLIENT_OK;
+    }
+
+    auto sent = true;
+    if (m_version == 1) {
+        sent = sendNonBlocking(m_source.fd, m_output, &response, sizeof(RudeDrawerResponse), &m_outputFds);
+    } else {
+        thread_local std::vector<uint8_t> message;
+        message.clear();
+        encodeResponse(response, m_requestId, message);
+        sent = sendNonBlocking(m_source.fd, m_output, message.data(), message.size(), &m_outputFds);
+    }
+
+    if (!sent) {
         std::cerr << "ERROR: could not send data to the client: "
                   << strerror(errno) << "\n";
+        close();
         return CLIENT_ERR;
     }
     return CLIENT_OK;
@@ -55,65 +297,101 @@ ClientResult Client::sendErrOrFail(RudeDrawerErrorKind err) noexcept(true)
     RudeDrawerResponse response;
     response.kind = RDRESP_EMPTY;
     response.errorKind = err;
-    return sendOrFail(&response, sizeof(RudeDrawerResponse));
+    return respondOrFail(response);
 }
 
-void AppDrawer::listener() noexcept(true)
-{
-    if (listen(m_fd, 20) < 0) {
-        std::cerr << "ERROR: could not listen to socket: " << strerror(errno);
-        goto exit;
-    }
-    std::cout << "[INFO] Listening to socket `" << SOCKET_PATH << "`...\n";
-
-    struct sockaddr_un clientAddr;
-    while (true) {
-        socklen_t clientLen = sizeof(struct sockaddr_un);
-        std::cout << "[INFO] Waiting for connection...\n";
-        auto clientFd = accept(m_fd, (struct sockaddr*)&clientAddr, &clientLen);
-        if (clientFd < 0) {
-            std::cerr << "ERROR: could not accept connection: "
-                      << strerror(errno) << "\n";
-            continue;
-        }
+// Accepts the connections to the socket of AppDrawer, and hands them out to
+// the loops of the reactor.
+class Listener : public ReactorHandler {
+private:
+    AppDrawer* m_appdrawer;
+    Reactor* m_reactor;
+    ReactorSource m_source;
+
+public:
+    Listener(AppDrawer* appdrawer, Reactor* reactor, int fd) noexcept(true)
+        : ReactorHandler(0)
+    {
+        m_appdrawer = appdrawer;
+        m_reactor = reactor;
+        m_source = ReactorSource { this, fd };
+    }
 
-        std::thread thread(&AppDrawer::handleClient, this, clientFd);
-        thread.detach();
+    bool start() noexcept(true)
+    {
+        return m_reactor->add(&m_source, EPOLLIN);
     }
-exit:
-    std::cout << "Exiting `listener()` thread...\n";
-}
 
-void AppDrawer::handleClient(int clientFd) noexcept(true)
-{
-    Client client(clientFd);
+    void onReady(ReactorSource*, uint32_t) noexcept(true) override
+    {
+        while (true) {
+            auto clientFd = accept4(m_source.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (clientFd < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    std::cerr << "ERROR: could not accept connection: "
+                              << strerror(errno) << "\n";
+                return;
+            }
 
-    RudeDrawerCommand command;
-    while (true) {
-        if (client.receiveOrFail(&command, sizeof(RudeDrawerCommand)) != CLIENT_OK) {
-            goto exit;
+            std::cout << "[INFO] Accepted connection\n";
+            m_appdrawer->addClient(clientFd);
         }
+    }
+};
 
-        std::cout << "[INFO] Received data\n";
-        switch (command.kind) {
-        case RDCMD_PING:
-            std::cout << "  => Pong!\n";
-            if (client.sendErrOrFail(RDERROR_OK) != CLIENT_OK)
-                continue;
-            break;
-        case RDCMD_ADD_WIN: {
-            std::cout << "  => Adding window\n";
-            std::cout << "    -> Dimensions: "
-                      << command.windowDims.x << "x" << command.windowDims.y
-                      << "\n";
-            std::string title((char*)command.windowTitle);
+// Locks the windows of an `AppDrawer` to change them. What they changed is
+// published once the outermost writer is done, so that a batch publishes once.
+class WindowsWriter {
+private:
+    AppDrawer* m_appdrawer;
+
+public:
+    WindowsWriter(AppDrawer* appdrawer) noexcept(true)
+    {
+        m_appdrawer = appdrawer;
+        m_appdrawer->m_windowsMutex.lock();
+        m_appdrawer->m_writers += 1;
+    }
+
+    ~WindowsWriter() noexcept(false)
+    {
+        auto outermost = --m_appdrawer->m_writers == 0;
+        if (outermost)
+            m_appdrawer->publishWindows();
+        m_appdrawer->m_windowsMutex.unlock();
+
+        // Unlocked, as unmapping the buffers of large windows takes long too
+        if (outermost)
+            m_appdrawer->m_epochs.reclaim();
+    }
+};
 
-            auto res = addWindow(title, command.windowDims);
-            if (!res.isOk()) {
+void AppDrawer::handleCommand(Client& client, RudeDrawerCommand& command) noexcept(true)
+{
+    // The windows found by the command are not reclaimed until it is done
+    EpochGuard pinned(m_epochs);
+
+    switch (command.kind) {
+    case RDCMD_PING:
+        std::cout << "  => Pong!\n";
+        if (client.sendErrOrFail(RDERROR_OK) != CLIENT_OK)
+            return;
+        break;
+    case RDCMD_ADD_WIN: {
+        std::cout << "  => Adding window\n";
+        std::cout << "    -> Dimensions: "
+                  << command.windowDims.x << "x" << command.windowDims.y
+                  << "\n";
+
+        takeWindow(client, command, [this, &client](Window* window) {
+            if (window == nullptr) {
                 client.sendErrOrFail(RDERROR_ADD_WIN_FAILED);
-                continue;
+                return;
             }
-            auto id = res.getValue();
+            auto id = window->m_id;
+            publishWindow(window);
 
             std::cout << "    -> ID: " << id << "\n";
 
@@ -121,262 +399,502 @@ void AppDrawer::handleClient(int clientFd) noexcept(true)
             response.kind = RDRESP_WINID;
             response.errorKind = RDERROR_OK;
             response.windowId = id;
-            if (client.sendOrFail(&response, sizeof(RudeDrawerResponse)) != CLIENT_OK)
-                continue;
-        } break;
-        case RDCMD_REMOVE_WIN: {
-            std::cout << "  => Removing window\n";
-            std::cout << "    -> ID: " << command.windowId << "\n";
-
-            auto res = removeWindow(command.windowId);
-            if (!res.isOk()) {
-                client.sendErrOrFail(RDERROR_INVALID_WINID);
-                continue;
-            }
+            client.respondOrFail(response);
+        });
+    } break;
+    case RDCMD_REMOVE_WIN: {
+        std::cout << "  => Removing window\n";
+        std::cout << "    -> ID: " << command.windowId << "\n";
+
+        auto res = removeWindow(command.windowId);
+        if (!res.isOk()) {
+            client.sendErrOrFail(RDERROR_INVALID_WINID);
+            return;
+        }
 
-            if (client.sendErrOrFail(RDERROR_OK) != CLIENT_OK)
-                continue;
-        } break;
-        case RDCMD_START_POLLING_EVENTS_WIN: {
-            std::cout << "  => Starting polling events for window\n";
-            std::cout << "    -> ID: " << command.windowId << "\n";
-
-            auto res1 = setWindowPolling(command.windowId, true);
-            if (!res1.isOk()) {
-                client.sendErrOrFail(RDERROR_INVALID_WINID);
-                continue;
-            }
+        if (client.sendErrOrFail(RDERROR_OK) != CLIENT_OK)
+            return;
+    } break;
+    case RDCMD_START_POLLING_EVENTS_WIN: {
+        std::cout << "  => Starting polling events for window\n";
+        std::cout << "    -> ID: " << command.windowId << "\n";
+
+        // The event socket is listening once this returns
+        auto res = startPollingSocket(command.windowId);
+        if (!res.isOk()) {
+            client.sendErrOrFail(res.getError());
+            return;
+        }
 
-            auto res2 = findWindow(command.windowId);
-            if (!res2.isOk()) {
-                client.sendErrOrFail(RDERROR_INVALID_WINID);
-                continue;
-            }
-            auto i = res2.getValue();
-
-            std::thread thread(&AppDrawer::pollEvents, this, m_windows[i]);
-            thread.detach();
-
-            auto timeout = 0;
-            auto timeoutLimit = 9999999;
-            while (!m_windowsWithEventSockets.contains(command.windowId)) {
-                timeout += 1;
-                if (timeout >= timeoutLimit) {
-                    std::cerr << "ERROR: timed out when waiting for event socket to"
-                                << " be available (window id `" << command.windowId << "`)\n";
-                    client.sendErrOrFail(RDERROR_CANT_POLL_EVENTS);
-                    break;
-                }
-            }
+        if (client.sendErrOrFail(RDERROR_OK) != CLIENT_OK)
+            return;
+    } break;
+    case RDCMD_START_POLLING_EVENTS_SHM_WIN: {
+        std::cout << "  => Starting polling events for window through shared memory\n";
+        std::cout << "    -> ID: " << command.windowId << "\n";
 
-            if (timeout >= timeoutLimit)
-                continue;
+        // The queue is passed before the window can be removed
+        std::lock_guard<std::recursive_mutex> guard(m_windowsMutex);
 
-            if (client.sendErrOrFail(RDERROR_OK) != CLIENT_OK)
-                continue;
-        } break;
-        case RDCMD_STOP_POLLING_EVENTS_WIN: {
-            std::cout << "  => Stopping polling events for window\n";
-            std::cout << "    -> ID: " << command.windowId << "\n";
-
-            auto res = setWindowPolling(command.windowId, false);
-            if (!res.isOk()) {
-                client.sendErrOrFail(RDERROR_INVALID_WINID);
-                continue;
-            }
+        auto res = startPollingSharedMemory(command.windowId);
+        if (!res.isOk()) {
+            client.sendErrOrFail(res.getError());
+            return;
+        }
+        auto& events = res.getValue()->m_events;
+
+        RudeDrawerResponse response;
+        response.kind = RDRESP_SHM_NAME;
+        response.errorKind = RDERROR_OK;
+        response.shmFd = events.queueShmFd;
+        std::memset(response.windowShmName, 0, WINDOW_SHM_NAME_MAX);
+        std::memcpy(response.windowShmName, events.queueShmName.c_str(), events.queueShmName.size());
+        if (client.respondOrFail(response) != CLIENT_OK)
+            return;
+    } break;
+    case RDCMD_STOP_POLLING_EVENTS_WIN: {
+        std::cout << "  => Stopping polling events for window\n";
+        std::cout << "    -> ID: " << command.windowId << "\n";
+
+        auto res = stopPolling(command.windowId);
+        if (!res.isOk()) {
+            client.sendErrOrFail(RDERROR_INVALID_WINID);
+            return;
+        }
 
-            if (client.sendErrOrFail(RDERROR_OK) != CLIENT_OK)
-                continue;
+        if (client.sendErrOrFail(RDERROR_OK) != CLIENT_OK)
+            return;
 
-        } break;
-        case RDCMD_GET_DISPLAY_SHM_WIN: {
-            std::cout << "  => Getting window display's shared memory\n";
-            std::cout << "    -> ID: " << command.windowId << "\n";
+    } break;
+    case RDCMD_GET_DISPLAY_SHM_WIN: {
+        std::cout << "  => Getting window display's shared memory\n";
+        std::cout << "    -> ID: " << command.windowId << "\n";
 
-            auto res = findWindow(command.windowId);
-            if (!res.isOk()) {
-                client.sendErrOrFail(RDERROR_INVALID_WINID);
-                continue;
-            }
-            auto i = res.getValue();
+        // The buffers are passed before the window can be removed
+        std::lock_guard<std::recursive_mutex> guard(m_windowsMutex);
 
-            auto shmName = m_windows[i]->m_pixelsShmName;
+        auto res = findWindow(command.windowId);
+        if (!res.isOk()) {
+            client.sendErrOrFail(RDERROR_INVALID_WINID);
+            return;
+        }
 
-            RudeDrawerResponse response;
-            response.kind = RDRESP_SHM_NAME;
-            response.errorKind = RDERROR_OK;
+        auto window = res.getValue();
+        auto shmName = window->m_pixelsShmName;
+
+        RudeDrawerResponse response;
+        response.kind = RDRESP_SHM_NAME;
+        response.errorKind = RDERROR_OK;
+        response.shmFd = window->m_pixelsShmFd;
+        {
+            std::lock_guard<std::mutex> guard(window->m_bufferMutex);
+            response.windowBufferCount = window->m_bufferCount;
+            response.windowBufferIndex = window->m_backBuffer;
+        }
 
-            std::memset(response.windowShmName, 0, WINDOW_SHM_NAME_MAX);
-            std::memcpy(response.windowShmName, shmName.c_str(), shmName.size());
+        std::memset(response.windowShmName, 0, WINDOW_SHM_NAME_MAX);
+        std::memcpy(response.windowShmName, shmName.c_str(), shmName.size());
 
-            if (client.sendOrFail(&response, sizeof(RudeDrawerResponse)) != CLIENT_OK)
-                continue;
-        } break;
-        case RDCMD_SEND_PAINT_EVENT: {
-            std::cout << "  => Sending paint event to window\n";
-            std::cout << "    -> ID: " << command.windowId << "\n";
-
-            auto res = findWindow(command.windowId);
-            if (!res.isOk()) {
-                client.sendErrOrFail(RDERROR_INVALID_WINID);
-                continue;
+        if (client.respondOrFail(response) != CLIENT_OK)
+            return;
+    } break;
+    case RDCMD_SEND_PAINT_EVENT: {
+        std::cout << "  => Sending paint event to window\n";
+        std::cout << "    -> ID: " << command.windowId << "\n";
+
+        auto res = findWindow(command.windowId);
+        if (!res.isOk()) {
+            client.sendErrOrFail(RDERROR_INVALID_WINID);
+            return;
+        }
+        res.getValue()->requestPaint();
+    } break;
+    case RDCMD_GET_MOUSE_POSITION: {
+        std::cout << "  => Getting mouse position within window\n";
+        std::cout << "    -> ID: " << command.windowId << "\n";
+
+        auto res = findWindow(command.windowId);
+        if (!res.isOk()) {
+            if (client.sendErrOrFail(RDERROR_INVALID_WINID) != CLIENT_OK)
+                return;
+            return;
+        }
+        auto window = res.getValue();
+
+        RudeDrawerResponse response;
+        response.kind = RDRESP_MOUSE_POSITION;
+        response.errorKind = RDERROR_OK;
+
+        auto mousePosX = m_mousePos.x - window->m_area.x;
+        auto mousePosY = m_mousePos.y - window->m_area.y;
+        auto outOfX = mousePosX < 0 || mousePosX > window->m_area.width;
+        auto outOfY = mousePosY < 0 || mousePosY > window->m_area.height;
+        if (outOfX || outOfY) {
+            mousePosX = 0;
+            mousePosY = 0;
+        }
+
+        response.mousePos = RudeDrawerVec2D {
+            .x = (int)mousePosX,
+            .y = (int)mousePosY,
+        };
+        if (client.respondOrFail(response) != CLIENT_OK)
+            return;
+    } break;
+    case RDCMD_GET_MOUSE_DELTA: {
+        std::cout << "  => Getting mouse delta\n";
+
+        RudeDrawerResponse response;
+        response.kind = RDRESP_MOUSE_DELTA;
+        response.errorKind = RDERROR_OK;
+
+        response.mouseDelta = RudeDrawerVec2D {
+            .x = (int)(m_mousePos.x - m_previousMousePos.x),
+            .y = (int)(m_mousePos.y - m_previousMousePos.y),
+        };
+        if (client.respondOrFail(response) != CLIENT_OK)
+            return;
+    } break;
+    case RDCMD_DAMAGE_WIN: {
+        std::cout << "  => Damaging window\n";
+        std::cout << "    -> ID: " << command.windowId << "\n";
+
+        auto res = findWindow(command.windowId);
+        if (!res.isOk()) {
+            return;
+        }
+        auto count = std::min(command.damageRectsCount, (uint32_t)DAMAGE_RECTS_MAX);
+        res.getValue()->addDamage(command.damageRects, count);
+    } break;
+    case RDCMD_COMMIT_WIN: {
+        auto res = findWindow(command.windowId);
+        if (!res.isOk()) {
+            client.sendErrOrFail(RDERROR_INVALID_WINID);
+            return;
+        }
+        RudeDrawerResponse response;
+        response.kind = RDRESP_BUFFER_INDEX;
+        response.errorKind = RDERROR_OK;
+
+        // Sent by the render thread once it stops reading the next buffer. The
+        // responses of a batch cannot wait.
+        std::function<void(uint32_t)> released = nullptr;
+        if (!client.m_batching) {
+            released = [&client, response](uint32_t next) mutable {
+                response.windowBufferIndex = next;
+                client.resume([&client, response] { client.respondOrFail(response); });
+            };
+        }
+
+        uint32_t next = 0;
+        auto result = res.getValue()->commit(next, std::move(released));
+        if (result == COMMIT_BUSY) {
+            client.sendErrOrFail(RDERROR_BUFFER_BUSY);
+            return;
+        }
+        if (result == COMMIT_PENDING) {
+            client.park();
+            return;
+        }
+        response.windowBufferIndex = next;
+        if (client.respondOrFail(response) != CLIENT_OK)
+            return;
+    } break;
+    case RDCMD_CREATE_SURFACE: {
+        std::cout << "  => Creating surface\n";
+        std::cout << "    -> Dimensions: "
+                  << command.windowDims.x << "x" << command.windowDims.y
+                  << "\n";
+
+        auto eventsSharedMemory = command.windowEventsSharedMemory;
+        takeWindow(client, command, [this, &client, eventsSharedMemory](Window* window) {
+            if (window == nullptr) {
+                client.sendErrOrFail(RDERROR_ADD_WIN_FAILED);
+                return;
             }
-            auto i = res.getValue();
-
-            RudeDrawerEvent event;
-            event.kind = RDEVENT_PAINT;
-            m_windows[i]->sendEvent(event);
-        } break;
-        case RDCMD_GET_MOUSE_POSITION: {
-            std::cout << "  => Getting mouse position within window\n";
-            std::cout << "    -> ID: " << command.windowId << "\n";
-
-            auto res = findWindow(command.windowId);
-            if (!res.isOk()) {
-                if (client.sendErrOrFail(RDERROR_INVALID_WINID) != CLIENT_OK)
-                    continue;
-                continue;
+            auto id = window->m_id;
+            std::cout << "    -> ID: " << id << "\n";
+
+            // The window is not published until it is whole
+            WindowsWriter writer(this);
+            publishWindow(window);
+
+            // Owned if it is a socket, the window keeps its queue
+            auto eventFd = -1;
+            auto ownsEventFd = !eventsSharedMemory;
+            if (eventsSharedMemory) {
+                auto res = startPollingSharedMemory(id);
+                if (res.isOk())
+                    eventFd = window->m_events.queueShmFd;
+            } else {
+                auto res = startPollingSocketPair(id);
+                if (res.isOk())
+                    eventFd = res.getValue();
+            }
+            if (eventFd == -1) {
+                removeWindow(id);
+                client.sendErrOrFail(RDERROR_CANT_POLL_EVENTS);
+                return;
             }
-            auto i = res.getValue();
 
             RudeDrawerResponse response;
-            response.kind = RDRESP_MOUSE_POSITION;
+            response.kind = RDRESP_SURFACE;
             response.errorKind = RDERROR_OK;
-
-            auto mousePosX = m_mousePos.x - m_windows[i]->m_area.x;
-            auto mousePosY = m_mousePos.y - m_windows[i]->m_area.y;
-            auto outOfX = mousePosX < 0 || mousePosX > m_windows[i]->m_area.width;
-            auto outOfY = mousePosY < 0 || mousePosY > m_windows[i]->m_area.height;
-            if (outOfX || outOfY) {
-                mousePosX = 0;
-                mousePosY = 0;
+            response.windowId = id;
+            response.shmFd = window->m_pixelsShmFd;
+            response.eventFd = eventFd;
+            {
+                std::lock_guard<std::mutex> bufferGuard(window->m_bufferMutex);
+                response.windowBufferCount = window->m_bufferCount;
+                response.windowBufferIndex = window->m_backBuffer;
             }
 
-            response.mousePos = RudeDrawerVec2D {
-                .x = (int)mousePosX,
-                .y = (int)mousePosY,
-            };
-            if (client.sendOrFail(&response, sizeof(RudeDrawerResponse)) != CLIENT_OK)
-                continue;
-        } break;
-        case RDCMD_GET_MOUSE_DELTA: {
-            std::cout << "  => Getting mouse delta\n";
+            client.respondOrFail(response);
+            if (ownsEventFd)
+                close(eventFd);
+        });
+    } break;
+    case RDCMD_GET_STATS: {
+        std::cout << "  => Getting frame stats\n";
+
+        RudeDrawerResponse response;
+        response.kind = RDRESP_STATS;
+        response.errorKind = RDERROR_OK;
+        m_stats.snapshot(response.stats);
+        if (client.respondOrFail(response) != CLIENT_OK)
+            return;
+    } break;
+    default:
+        std::cerr << "  => ERROR: unknown command `" << command.kind << "`\n";
+        if (client.sendErrOrFail(RDERROR_INVALID_COMMAND) != CLIENT_OK)
+            return;
+    }
+}
 
-            RudeDrawerResponse response;
-            response.kind = RDRESP_MOUSE_DELTA;
-            response.errorKind = RDERROR_OK;
+void AppDrawer::handleBatch(Client& client, uint8_t const* payload, uint32_t length) noexcept(true)
+{
+    std::cout << "  => Running batch\n";
+
+    // Nothing runs unless every command is whole
+    MessageReader reader = { payload, length };
+    size_t count = 0;
+    auto whole = true;
+    for (; whole && reader.left > 0 && count <= BATCH_COMMANDS_MAX; ++count) {
+        RudeDrawerMessageHeader header;
+        uint8_t const* commandPayload = nullptr;
+        whole = readBatchMessage(reader, header, commandPayload);
+    }
+    if (!whole || count > BATCH_COMMANDS_MAX) {
+        std::cerr << "ERROR: malformed batch\n";
+        client.sendErrOrFail(RDERROR_INVALID_COMMAND);
+        return;
+    }
+    std::cout << "    -> Commands: " << count << "\n";
+
+    // The windows the commands add are prepared before the windows are locked
+    std::vector<RudeDrawerCommand> adding;
+    auto inlined = true;
+    reader = { payload, length };
+    for (size_t i = 0; i < count; ++i) {
+        RudeDrawerMessageHeader header;
+        uint8_t const* commandPayload = nullptr;
+        readBatchMessage(reader, header, commandPayload);
+
+        RudeDrawerCommand command;
+        if (decodeCommand(header, commandPayload, command) && commandAddsWindow(command.kind)) {
+            adding.push_back(command);
+            inlined = inlined && preparesInline(command);
+        }
+    }
 
-            response.mouseDelta = RudeDrawerVec2D {
-                .x = (int)(m_mousePos.x - m_previousMousePos.x),
-                .y = (int)(m_mousePos.y - m_previousMousePos.y),
-            };
-            if (client.sendOrFail(&response, sizeof(RudeDrawerResponse)) != CLIENT_OK)
-                continue;
-        } break;
-        default:
-            std::cerr << "  => ERROR: unknown command `" << command.kind << "`\n";
-            if (client.sendErrOrFail(RDERROR_INVALID_COMMAND) != CLIENT_OK)
-                continue;
+    if (inlined) {
+        for (auto& command : adding) {
+            auto res = prepareWindow(command);
+            client.m_preparedWindows.push_back(res.isOk() ? res.getValue() : nullptr);
         }
+        runBatch(client, payload, length, count);
+        return;
     }
 
-exit:
-    std::cout << "Exiting `handleClient()` thread...\n";
+    // The payload is gone once the client is parked
+    std::vector<uint8_t> commands(payload, payload + length);
+    client.park();
+    m_preparer.post(0, [this, &client, adding, commands, count] {
+        std::vector<Window*> prepared;
+        for (auto& command : adding) {
+            auto res = prepareWindow(command);
+            prepared.push_back(res.isOk() ? res.getValue() : nullptr);
+        }
+        client.resume([this, &client, prepared, commands, count] {
+            client.m_preparedWindows.assign(prepared.begin(), prepared.end());
+            if (client.m_retired) {
+                for (auto window : client.m_preparedWindows) {
+                    if (window == nullptr)
+                        continue;
+                    window->destroy();
+                    delete window;
+                }
+                client.m_preparedWindows.clear();
+                return;
+            }
+            runBatch(client, commands.data(), commands.size(), count);
+        });
+    });
 }
 
-void AppDrawer::pollEvents(Window* window) noexcept(true)
+void AppDrawer::runBatch(Client& client, uint8_t const* payload, uint32_t length, size_t count) noexcept(true)
 {
-    int serverEventSocket = -1;
-    int clientEventSocket = -1;
+    MessageReader reader;
+    auto requestId = client.m_requestId;
+    // The window of every command so far, for `BATCH_RESULT()`
+    std::vector<uint32_t> windowIds;
+    windowIds.reserve(count);
+
+    // Room for the header of the response, once its length is known
+    client.m_batching = true;
+    client.m_batchResponses.assign(sizeof(RudeDrawerMessageHeader), 0);
     {
-        std::string socketPath = "/tmp/APDWindowSock" + std::to_string(window->m_id);
-
-        if (fileExists(socketPath)) {
-            if (std::remove(socketPath.c_str()) != 0) {
-                std::cerr << "ERROR: could not remove `"
-                          << socketPath
-                          << "`: " << strerror(errno) << "\n";
-                goto exit;
+        // The commands lock the windows again, which only counts up
+        WindowsWriter writer(this);
+
+        reader = { payload, length };
+        for (uint32_t i = 0; i < count; ++i) {
+            RudeDrawerMessageHeader header;
+            uint8_t const* commandPayload = nullptr;
+            readBatchMessage(reader, header, commandPayload);
+
+            RudeDrawerCommand command;
+            if (!decodeCommand(header, commandPayload, command)) {
+                std::cerr << "ERROR: malformed command `" << header.kind << "`\n";
+                // Batches do not nest either
+                command.kind = (RudeDrawerCommandKind)-1;
+            } else if (commandHasWindowId(command.kind) && (command.windowId & BATCH_RESULT(0))) {
+                auto index = command.windowId & ~BATCH_RESULT(0);
+                // No window has ID 0, commands referring to a failed one fail too
+                command.windowId = index < i ? windowIds[index] : 0;
             }
-        }
 
-        serverEventSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+            client.m_requestId = i;
+            client.m_batchWindowId = 0;
+            handleCommand(client, command);
 
-        if (serverEventSocket < 0) {
-            std::cerr << "ERROR: could not open socket: `"
-                      << socketPath << "`\n";
-            goto exit;
+            if (client.m_batchWindowId != 0)
+                windowIds.push_back(client.m_batchWindowId);
+            else
+                windowIds.push_back(commandHasWindowId(command.kind) ? command.windowId : 0);
         }
+    }
+    client.m_batching = false;
+    client.m_requestId = requestId;
+    // Every command took its window, unless the client is gone
+    for (auto window : client.m_preparedWindows) {
+        if (window == nullptr)
+            continue;
+        window->destroy();
+        delete window;
+    }
+    client.m_preparedWindows.clear();
+    if (client.m_retired)
+        return;
+
+    RudeDrawerMessageHeader header = { RDRESP_BATCH, RDERROR_OK, requestId,
+        (uint32_t)(client.m_batchResponses.size() - sizeof(header)) };
+    std::memcpy(client.m_batchResponses.data(), &header, sizeof(header));
+    if (!sendNonBlocking(client.m_source.fd, client.m_output,
+            client.m_batchResponses.data(), client.m_batchResponses.size(), &client.m_outputFds)) {
+        std::cerr << "ERROR: could not send data to the client: "
+                  << strerror(errno) << "\n";
+        client.close();
+    }
+}
 
-        struct sockaddr_un serverAddr;
-        std::memset(&serverAddr, 0, sizeof(struct sockaddr_un));
-        serverAddr.sun_family = AF_UNIX;
-        std::strncpy(serverAddr.sun_path, socketPath.c_str(),
-            sizeof(serverAddr.sun_path) - 1);
-
-        auto opt = SO_REUSEADDR;
-        setsockopt(serverEventSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+Result<void*, Window*> AppDrawer::prepareWindow(RudeDrawerCommand const& command) noexcept(false)
+{
+    auto bufferCount = std::max(command.windowBufferCount, (uint32_t)1);
+    if (bufferCount > WINDOW_BUFFERS_MAX) {
+        std::cerr << "ERROR: windows can have at most " << WINDOW_BUFFERS_MAX
+                  << " buffers, got " << bufferCount << "\n";
+        return Result<void*, Window*>::fromError(nullptr);
+    }
+    std::cout << "    -> Buffers: " << bufferCount << "\n";
 
-        if (bind(serverEventSocket, (struct sockaddr*)&serverAddr,
-                sizeof(struct sockaddr_un))
-            < 0) {
-            std::cerr << "ERROR: could not bind to socket: " << strerror(errno) << "\n";
-            goto exit;
-        }
+    auto dims = command.windowDims;
+    if (dims.x <= 0 || dims.y <= 0 || dims.x > WINDOW_DIMENSION_MAX || dims.y > WINDOW_DIMENSION_MAX) {
+        std::cerr << "ERROR: windows are from 1x1 to " << WINDOW_DIMENSION_MAX << "x" << WINDOW_DIMENSION_MAX
+                  << ", got " << dims.x << "x" << dims.y << "\n";
+        return Result<void*, Window*>::fromError(nullptr);
+    }
 
-        if (listen(serverEventSocket, 1) < 0) {
-            std::cerr << "ERROR: could not listen to socket: " << strerror(errno) << "\n";
-            goto exit;
-        }
+    auto id = m_windowId++;
+    std::string title((char*)command.windowTitle);
 
-        m_windowsWithEventSockets.insert(window->m_id);
+    auto res = Window::create(title, dims.x, dims.y, id, bufferCount);
+    if (!res.isOk()) {
+        return Result<void*, Window*>::fromError(nullptr);
+    }
 
-        struct sockaddr_un clientAddr;
-        socklen_t clientLen = sizeof(struct sockaddr_un);
-        clientEventSocket = accept(serverEventSocket, (struct sockaddr*)&clientAddr, &clientLen);
-        if (clientEventSocket < 0) {
-            std::cerr << "ERROR: could not accept connection: "
-                      << strerror(errno) << "\n";
-            goto exit;
-        }
+    Window* window = res.getValue();
+    window->m_area.x = (float)m_screenWidth / 2 - (float)dims.x / 2;
+    window->m_area.y = (float)m_screenHeight / 2 - (float)dims.y / 2;
+    window->m_alwaysUpdating = command.windowAlwaysUpdating;
+    window->m_stats = &m_stats;
 
-        Client client(clientEventSocket);
+    return Result<void*, Window*>::fromValue(window);
+}
 
-        while (window->m_events.isPolling) {
-            if (!window->m_events.events.empty()) {
-                auto event = window->m_events.events.back();
-                window->m_events.events.pop_back();
+// Windows whose buffers take at most this many bytes are prepared on the thread
+// of their client, as handing them over to the preparer would take longer
+#define WINDOW_PREPARE_INLINE_MAX (1024 * 1024)
 
-                if (client.sendOrFail(&event, sizeof(RudeDrawerEvent)) != CLIENT_OK)
-                    continue;
-            }
-        }
-    }
-exit:
-    close(serverEventSocket);
-    close(clientEventSocket);
-    if (auto iter = m_windowsWithEventSockets.find(window->m_id);
-        iter != m_windowsWithEventSockets.end())
-        m_windowsWithEventSockets.erase(iter);
-    window->m_events.running = false;
-    std::cout << "Exiting `pollEvents()` thread...\n";
+bool AppDrawer::preparesInline(RudeDrawerCommand const& command) noexcept(true)
+{
+    auto dims = command.windowDims;
+    if (dims.x <= 0 || dims.y <= 0 || dims.x > WINDOW_DIMENSION_MAX || dims.y > WINDOW_DIMENSION_MAX)
+        return true;
+    auto bufferCount = std::clamp(command.windowBufferCount, (uint32_t)1, (uint32_t)WINDOW_BUFFERS_MAX);
+    return (size_t)dims.x * dims.y * COMPONENTS * bufferCount <= WINDOW_PREPARE_INLINE_MAX;
 }
 
-Result<void*, uint32_t> AppDrawer::addWindow(std::string title, RudeDrawerVec2D dims) noexcept(false)
+void AppDrawer::takeWindow(Client& client, RudeDrawerCommand const& command,
+    std::function<void(Window*)> added) noexcept(false)
 {
-    std::lock_guard<std::mutex> guard(m_windowsMutex);
-
-    auto id = m_windowId++;
+    if (client.m_batching) {
+        auto window = client.m_preparedWindows.front();
+        client.m_preparedWindows.pop_front();
+        added(window);
+        return;
+    }
 
-    auto res = Window::create(title, dims.x, dims.y, id);
-    if (!res.isOk()) {
-        return Result<void*, uint32_t>::fromError(nullptr);
+    if (preparesInline(command)) {
+        auto res = prepareWindow(command);
+        added(res.isOk() ? res.getValue() : nullptr);
+        return;
     }
 
-    Window* window = res.getValue();
-    m_windows.push_back(window);
+    client.park();
+    m_preparer.post(0, [this, &client, command, added] {
+        auto res = prepareWindow(command);
+        auto window = res.isOk() ? res.getValue() : nullptr;
+        client.resume([this, &client, window, added] {
+            if (client.m_retired) {
+                if (window != nullptr) {
+                    window->destroy();
+                    delete window;
+                }
+                return;
+            }
+            EpochGuard pinned(m_epochs);
+            added(window);
+        });
+    });
+}
 
-    return Result<void*, uint32_t>::fromValue(id);
+void AppDrawer::publishWindow(Window* window) noexcept(false)
+{
+    WindowsWriter writer(this);
+
+    m_windows.insert(window);
+    m_grid.insert(window);
 }
 
 void AppDrawer::setMousePosition(Vector2 mousePos) noexcept(true)
@@ -385,76 +903,192 @@ void AppDrawer::setMousePosition(Vector2 mousePos) noexcept(true)
     m_mousePos = mousePos;
 }
 
-Result<void*, int> AppDrawer::findWindow(uint32_t id) noexcept(false)
+void AppDrawer::sendFrameEvents() noexcept(true)
 {
-    for (unsigned long i = 0; i < m_windows.size(); ++i) {
-        if (m_windows[i]->m_id == id) {
-            return Result<void*, int>::fromValue(i);
-        }
+    auto event = Window::makeEvent(RDEVENT_FRAME);
+
+    EpochGuard pinned(m_epochs);
+    for (auto w : m_windows.snapshot()) {
+        w->deliverPaint();
+        if (w->m_alwaysUpdating && w->m_visible)
+            w->sendEvent(event);
+        w->flushEvents();
     }
+}
 
-    std::cerr << "ERROR: could not find window of ID `" << id << "`\n";
-    return Result<void*, int>::fromError(nullptr);
+FrameStats& AppDrawer::stats() noexcept(true)
+{
+    return m_stats;
+}
+
+Result<void*, Window*> AppDrawer::findWindow(uint32_t id) noexcept(false)
+{
+    auto window = m_windows.find(id);
+    if (window == nullptr) {
+        std::cerr << "ERROR: could not find window of ID `" << id << "`\n";
+        return Result<void*, Window*>::fromError(nullptr);
+    }
+
+    return Result<void*, Window*>::fromValue(window);
 }
 
 Result<void*, void*> AppDrawer::removeWindow(uint32_t id) noexcept(false)
 {
-    std::lock_guard<std::mutex> guard(m_windowsMutex);
+    WindowsWriter writer(this);
 
-    auto res1 = findWindow(id);
-    if (!res1.isOk()) {
+    auto res = findWindow(id);
+    if (!res.isOk()) {
         return Result<void*, void*>::fromError(nullptr);
     }
-    auto i = res1.getValue();
+    auto window = res.getValue();
+
+    // The event channel closes on its own, without the window, which is only
+    // destroyed once the threads drawing it are done, see `publishWindows()`
+    window->stopPolling();
+    m_windows.remove(id);
+    m_grid.remove(window);
+    m_removedWindows.push_back(window);
+
+    return Result<void*, void*>::fromValue(nullptr);
+}
+
+Result<RudeDrawerErrorKind, void*> AppDrawer::startPollingSocket(uint32_t id) noexcept(false)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_windowsMutex);
+
+    auto res = findWindow(id);
+    if (!res.isOk()) {
+        return Result<RudeDrawerErrorKind, void*>::fromError(RDERROR_INVALID_WINID);
+    }
+    auto window = res.getValue();
 
-    m_windows[i]->m_events.isPolling = false;
-    // Wait for `pollEvents` thread to exit
-    while (m_windows[i]->m_events.running)
-        asm("nop");
+    auto ring = std::make_shared<EventRing>();
+    if (!ring->open().isOk() || !EventChannel::open(&m_reactor, id, ring).isOk()) {
+        return Result<RudeDrawerErrorKind, void*>::fromError(RDERROR_CANT_POLL_EVENTS);
+    }
+    window->startPolling(ring);
+
+    return Result<RudeDrawerErrorKind, void*>::fromValue(nullptr);
+}
+
+Result<RudeDrawerErrorKind, int> AppDrawer::startPollingSocketPair(uint32_t id) noexcept(false)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_windowsMutex);
+
+    auto res = findWindow(id);
+    if (!res.isOk()) {
+        return Result<RudeDrawerErrorKind, int>::fromError(RDERROR_INVALID_WINID);
+    }
+    auto window = res.getValue();
 
-    auto res2 = m_windows[i]->destroy();
+    auto ring = std::make_shared<EventRing>();
+    if (!ring->open().isOk()) {
+        return Result<RudeDrawerErrorKind, int>::fromError(RDERROR_CANT_POLL_EVENTS);
+    }
+    auto res2 = EventChannel::openPair(&m_reactor, ring);
     if (!res2.isOk()) {
-        return Result<void*, void*>::fromError(nullptr);
+        return Result<RudeDrawerErrorKind, int>::fromError(RDERROR_CANT_POLL_EVENTS);
     }
+    window->startPolling(ring);
 
-    delete m_windows[i];
+    return Result<RudeDrawerErrorKind, int>::fromValue(res2.getValue());
+}
 
-    m_windows.erase(m_windows.begin() + i);
+Result<RudeDrawerErrorKind, Window*> AppDrawer::startPollingSharedMemory(uint32_t id) noexcept(false)
+{
+    std::lock_guard<std::recursive_mutex> guard(m_windowsMutex);
 
-    return Result<void*, void*>::fromValue(nullptr);
+    auto res = findWindow(id);
+    if (!res.isOk()) {
+        return Result<RudeDrawerErrorKind, Window*>::fromError(RDERROR_INVALID_WINID);
+    }
+    auto window = res.getValue();
+
+    if (!window->openEventQueue().isOk()) {
+        return Result<RudeDrawerErrorKind, Window*>::fromError(RDERROR_CANT_POLL_EVENTS);
+    }
+    window->startPolling(nullptr);
+
+    return Result<RudeDrawerErrorKind, Window*>::fromValue(window);
 }
 
-Result<void*, void*> AppDrawer::setWindowPolling(uint32_t id, bool polling) noexcept(false)
+Result<void*, void*> AppDrawer::stopPolling(uint32_t id) noexcept(false)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_windowsMutex);
+
     auto res = findWindow(id);
     if (!res.isOk()) {
         return Result<void*, void*>::fromError(nullptr);
     }
-    auto i = res.getValue();
-    m_windows[i]->m_events.isPolling = polling;
+    res.getValue()->stopPolling();
 
     return Result<void*, void*>::fromValue(nullptr);
 }
 
 Result<void*, void*> AppDrawer::changeActiveWindow(uint32_t id)
 {
-    std::lock_guard<std::mutex> guard(m_windowsMutex);
+    WindowsWriter writer(this);
 
-    auto res = findWindow(id);
-    if (!res.isOk()) {
+    if (!m_windows.raise(id)) {
+        std::cerr << "ERROR: could not find window of ID `" << id << "`\n";
         return Result<void*, void*>::fromError(nullptr);
     }
-    auto windowIndex = res.getValue();
-
-    auto window = m_windows[windowIndex];
-    m_windows.erase(m_windows.begin() + windowIndex);
-    m_windows.push_back(window);
 
     return Result<void*, void*>::fromValue(nullptr);
 }
 
-AppDrawer::AppDrawer() noexcept(false)
+void AppDrawer::publishWindows() noexcept(false)
 {
+    m_windows.publish(m_epochs);
+
+    // Retired after the snapshot, so that no reader can find them anymore
+    for (auto window : m_removedWindows) {
+        m_epochs.retire([this, window] {
+            if (window->m_texture.id != 0) {
+                std::lock_guard<std::recursive_mutex> guard(m_windowsMutex);
+                m_staleTextures.push_back(window->m_texture);
+            }
+            window->destroy();
+            delete window;
+        });
+    }
+    m_removedWindows.clear();
+}
+
+Window* AppDrawer::windowAt(Vector2 point) noexcept(true)
+{
+    return m_grid.topmostAt(point);
+}
+
+void AppDrawer::moveWindow(Window* window, Vector2 delta) noexcept(false)
+{
+    window->m_area.x += delta.x;
+    window->m_area.y += delta.y;
+    m_grid.update(window);
+}
+
+bool AppDrawer::addClient(int fd) noexcept(true)
+{
+    auto client = new Client(this, &m_reactor, fd);
+    if (!client->start()) {
+        close(fd);
+        delete client;
+        return false;
+    }
+    return true;
+}
+
+AppDrawer::AppDrawer(int screenWidth, int screenHeight, int ioThreads, bool listening) noexcept(false)
+    : m_reactor(ioThreads)
+    , m_preparer(1)
+    , m_grid(screenWidth, screenHeight)
+{
+    m_screenWidth = screenWidth;
+    m_screenHeight = screenHeight;
+    m_fd = -1;
+    if (!listening)
+        return;
+
     if (fileExists(SOCKET_PATH))
         if (std::remove(SOCKET_PATH) != 0) {
             std::cerr << "ERROR: could not remove `"
@@ -464,7 +1098,7 @@ AppDrawer::AppDrawer() noexcept(false)
             exit(1);
         }
 
-    m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (m_fd < 0) {
         std::cerr << "ERROR: could not open socket: `"
                   << SOCKET_PATH << "`\n";
@@ -487,16 +1121,29 @@ AppDrawer::AppDrawer() noexcept(false)
         exit(1);
     }
 
-    std::thread thread(&AppDrawer::listener, this);
-    thread.detach();
+    if (listen(m_fd, 20) < 0) {
+        std::cerr << "ERROR: could not listen to socket: " << strerror(errno) << "\n";
+        exit(1);
+    }
+
+    auto listener = new Listener(this, &m_reactor, m_fd);
+    if (!listener->start()) {
+        exit(1);
+    }
+    std::cout << "[INFO] Listening to socket `" << SOCKET_PATH << "` on "
+              << m_reactor.threadCount() << " thread(s)...\n";
 }
 
 AppDrawer::~AppDrawer() noexcept(true)
 {
-    for (auto& w : m_windows) {
+    std::lock_guard<std::recursive_mutex> guard(m_windowsMutex);
+
+    for (auto w : m_windows.snapshot()) {
         w->destroy();
     }
-    close(m_fd);
+    m_epochs.reclaim();
+    if (m_fd != -1)
+        close(m_fd);
 }
 
 void AppDrawer::lockWindows() noexcept(true)
@@ -509,9 +1156,32 @@ void AppDrawer::unlockWindows() noexcept(true)
     m_windowsMutex.unlock();
 }
 
+void AppDrawer::unloadStaleTextures() noexcept(true)
+{
+    for (auto& texture : m_staleTextures) {
+        UnloadTexture(texture);
+    }
+    m_staleTextures.clear();
+}
+
+void AppDrawer::reclaimWindows() noexcept(false)
+{
+    m_epochs.reclaim();
+}
+
+Epochs& AppDrawer::epochs() noexcept(true)
+{
+    return m_epochs;
+}
+
+std::vector<Window*> const& AppDrawer::windows() noexcept(true)
+{
+    return m_windows.snapshot();
+}
+
 Window* AppDrawer::topWindow() noexcept(true)
 {
-    return m_windows.back();
+    return m_windows.top();
 }
 
 int AppDrawer::windowCount() noexcept(true)
@@ -519,7 +1189,3 @@ int AppDrawer::windowCount() noexcept(true)
     return m_windows.size();
 }
 
-Window* AppDrawer::windowIndex(int index) noexcept(false)
-{
-    return m_windows[index];
-}
@@ -1,13 +1,20 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <raylib.h>
 #include <vector>
 #include <mutex>
-#include <unordered_set>
 
+#include "Epochs.h"
+#include "FrameStats.h"
+#include "Reactor.h"
 #include "RudeDrawer.h"
 #include "Window.h"
+#include "WindowGrid.h"
+#include "WindowTable.h"
 
 #include "ErrorHandling.h"
 
@@ -17,48 +24,182 @@ enum ClientResult {
     CLIENT_ERR,
 };
 
-class Client {
+class AppDrawer;
+
+// A connection to the socket of AppDrawer, handled on a reactor thread. Commands
+// are handled as soon as they are whole, and responses are sent as the socket
+// takes them. While some are pending, no more commands are read.
+class Client : public ReactorHandler {
+    friend class AppDrawer;
+
 private:
-    int m_sockfd;
+    AppDrawer* m_appdrawer;
+    Reactor* m_reactor;
+    ReactorSource m_source;
+    uint32_t m_watching;
+    // The version of the protocol spoken by the client, 0 until it is known,
+    // see `PROTOCOL_VERSION`.
+    uint32_t m_version = 0;
+    // The request ID of the command being handled, copied into its response.
+    uint32_t m_requestId = 0;
+    // Bytes received that do not make a whole command yet
+    std::vector<uint8_t> m_input;
+    // Responses the socket could not take yet
+    std::vector<uint8_t> m_output;
+    // Shared memories passed to the client along with the next bytes of `m_output`
+    std::vector<int> m_outputFds;
+    // Whether the commands of a batch are being handled, see `AppDrawer::handleBatch()`.
+    // Their responses are kept in `m_batchResponses` instead of being sent.
+    bool m_batching = false;
+    std::vector<uint8_t> m_batchResponses;
+    // The window added by the command of the batch being handled, if any
+    uint32_t m_batchWindowId = 0;
+    // The windows of the commands of the batch that add one, in order, prepared
+    // before it locked the windows. nullptr for those that could not be.
+    std::deque<Window*> m_preparedWindows;
+    // Whether the response to a command is sent later, from another thread, see
+    // `park()`. No more commands are handled until then.
+    bool m_parked = false;
+    uint32_t m_parkedRequestId = 0;
+
+    ClientResult receive() noexcept(true);
+    void handleCommands() noexcept(true);
+    // Reads the version of the protocol from the first bytes received, and
+    // answers the `RudeDrawerHello` of clients that sent one. Returns how many
+    // bytes it took, 0 if it needs more.
+    size_t negotiate() noexcept(true);
+    // Handles the whole command at the start of `data`, and returns its size, 0 if
+    // it is not whole yet, or -1 if it is invalid.
+    long handleMessage(uint8_t const* data, size_t size) noexcept(true);
+    void watch(uint32_t events) noexcept(true);
+    // Watches what the client waits for after its commands were handled.
+    void rearm() noexcept(true);
+    void close() noexcept(true);
+    // Leaves the command being handled without a response, until `resume()`.
+    void park() noexcept(true);
+    // Calls `finish` on the thread of the client, to respond to the parked command,
+    // then handles the next ones. Can be called from any thread, once per `park()`.
+    // `finish` is called even if the client closed meanwhile.
+    void resume(std::function<void()> finish) noexcept(false);
 
 public:
-    Client(int sockfd) noexcept(true);
-    ClientResult receiveOrFail(void* data, int n) noexcept(true);
-    ClientResult sendOrFail(void* data, int n) noexcept(true);
+    Client(AppDrawer* appdrawer, Reactor* reactor, int sockfd) noexcept(true);
+    bool start() noexcept(true);
+    ClientResult respondOrFail(RudeDrawerResponse const& response) noexcept(true);
     ClientResult sendErrOrFail(RudeDrawerErrorKind err) noexcept(true);
+
+    void onReady(ReactorSource* source, uint32_t events) noexcept(true) override;
 };
 
 class AppDrawer {
+    friend class Client;
+    friend class WindowsWriter;
+
 private:
-    uint32_t m_windowId = 1;
+    // Taken without the windows locked, see `prepareWindow()`
+    std::atomic<uint32_t> m_windowId = 1;
     int m_fd;
+    int m_screenWidth;
+    int m_screenHeight;
     Vector2 m_mousePos;
     Vector2 m_previousMousePos;
-    std::unordered_set<uint32_t> m_windowsWithEventSockets;
+    // Handles the clients and delivers events, on a bounded number of threads.
+    // Accepts connections on its first loop.
+    Reactor m_reactor;
+    // Prepares large windows on a thread of its own, so that the clients of the
+    // thread of their client are not held up meanwhile, see `takeWindow()`.
+    Reactor m_preparer;
+
+    // Recursive, so that the commands of a batch can run while it is held.
+    // Changing the windows needs it, reading the published ones does not.
+    std::recursive_mutex m_windowsMutex;
+    WindowTable m_windows;
+    // The windows by their bounds on the screen
+    WindowGrid m_grid;
+    // Textures of removed windows. They can only be unloaded by the render
+    // thread, see `unloadStaleTextures()`.
+    std::vector<Texture2D> m_staleTextures;
+    // Writers nested in the outermost one, see `WindowsWriter`
+    uint32_t m_writers = 0;
+    // Windows removed since the windows were last published
+    std::vector<Window*> m_removedWindows;
+    // Pins the published windows and those removed since for their readers.
+    // Reclaims without the windows locked, and before what it reclaims into goes.
+    Epochs m_epochs;
 
-    std::mutex m_windowsMutex;
-    std::vector<Window*> m_windows;
+    FrameStats m_stats;
 
-    void listener() noexcept(true);
-    void handleClient(int clientFd) noexcept(true);
-    void pollEvents(Window* window) noexcept(true);
-    Result<void*, int> findWindow(uint32_t id) noexcept(false);
+    void handleCommand(Client& client, RudeDrawerCommand& command) noexcept(true);
+    // Handles the commands in the payload of an `RDCMD_BATCH`, with the windows
+    // locked once for all of them. The windows they add are prepared first, on
+    // the preparer if any is large.
+    void handleBatch(Client& client, uint8_t const* payload, uint32_t length) noexcept(true);
+    // Runs the `count` commands of a batch, once their windows are prepared.
+    void runBatch(Client& client, uint8_t const* payload, uint32_t length, size_t count) noexcept(true);
+    Result<void*, Window*> findWindow(uint32_t id) noexcept(false);
 
-    Result<void*, uint32_t> addWindow(std::string title, RudeDrawerVec2D dims) noexcept(false);
+    // Creates the window `command` adds along with its buffers, without the
+    // windows locked, as faulting in the pages of large buffers takes long.
+    // 0 buffers is one buffer.
+    Result<void*, Window*> prepareWindow(RudeDrawerCommand const& command) noexcept(false);
+    // Whether the window of `command` is small enough to be prepared right away.
+    static bool preparesInline(RudeDrawerCommand const& command) noexcept(true);
+    // Calls `added` with the window prepared for `command`, nullptr if it could
+    // not be. Right away if it is small or was prepared ahead of time for a batch,
+    // otherwise on the thread of the client once the preparer is done, with the
+    // client parked meanwhile.
+    void takeWindow(Client& client, RudeDrawerCommand const& command,
+        std::function<void(Window*)> added) noexcept(false);
+    // Adds a prepared window on top.
+    void publishWindow(Window* window) noexcept(false);
     Result<void*, void*> removeWindow(uint32_t id) noexcept(false);
-    Result<void*, void*> setWindowPolling(uint32_t id, bool polling) noexcept(false);
+    Result<RudeDrawerErrorKind, void*> startPollingSocket(uint32_t id) noexcept(false);
+    // Returns the end of the client of a socket pair sending the events, that the
+    // caller owns.
+    Result<RudeDrawerErrorKind, int> startPollingSocketPair(uint32_t id) noexcept(false);
+    // Returns the window, whose queue is in `m_events`. Must be locked to use it.
+    Result<RudeDrawerErrorKind, Window*> startPollingSharedMemory(uint32_t id) noexcept(false);
+    Result<void*, void*> stopPolling(uint32_t id) noexcept(false);
+    // Publishes the changes of the writers, and retires the removed windows,
+    // that are destroyed without the windows locked. Must be locked.
+    void publishWindows() noexcept(false);
 
 public:
     void lockWindows() noexcept(true);
     void unlockWindows() noexcept(true);
+    void unloadStaleTextures() noexcept(true);
+    // Reclaims the removed windows that no thread can see anymore.
+    void reclaimWindows() noexcept(false);
 
+    // What readers of `windows()` pin the windows with.
+    Epochs& epochs() noexcept(true);
+    // The windows ordered from bottom to top, as they were last published. Must
+    // be read within an epoch of `epochs()`, which does not block the commands
+    // changing them.
+    std::vector<Window*> const& windows() noexcept(true);
+    // The windows as they are now. Must be locked.
     Window* topWindow() noexcept(true);
-    Window* windowIndex(int index) noexcept(false);
     int windowCount() noexcept(true);
     Result<void*, void*> changeActiveWindow(uint32_t id) noexcept(false);
+    // The topmost window whose decorations contain `point`, nullptr if none. Must be locked.
+    Window* windowAt(Vector2 point) noexcept(true);
+    // Must be locked.
+    void moveWindow(Window* window, Vector2 delta) noexcept(false);
 
     void setMousePosition(Vector2 mousePos) noexcept(true);
+    // Sends the requested `RDEVENT_PAINT`s, and `RDEVENT_FRAME` to the visible
+    // windows that are always updating. Must be locked.
+    void sendFrameEvents() noexcept(true);
+
+    // Timings of the render loop, reported by `RDCMD_GET_STATS`.
+    FrameStats& stats() noexcept(true);
+
+    // Handles the client connected through `fd`, that it then owns. Can be
+    // called from any thread.
+    bool addClient(int fd) noexcept(true);
 
-    AppDrawer() noexcept(false);
+    // Clients are handled on `ioThreads` threads, 0 is one. Without `listening`,
+    // there is no socket, and clients are only added by `addClient()`.
+    AppDrawer(int screenWidth, int screenHeight, int ioThreads = 1, bool listening = true) noexcept(false);
     ~AppDrawer() noexcept(true);
 };
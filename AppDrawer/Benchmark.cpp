@@ -0,0 +1,984 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "AppDrawer.h"
+#include "Blend.h"
+#include "Decoration.h"
+#include "Epochs.h"
+#include "Framebuffer.h"
+#include "InputSampler.h"
+#include "Message.h"
+#include "RudeDrawer.h"
+#include "SoftwareCompositor.h"
+#include "Window.h"
+#include "WindowGrid.h"
+#include "WindowTable.h"
+
+// Every benchmark repeats its work for at least this long
+#define BENCHMARK_MIN_SECONDS 0.25
+
+#define BENCHMARK_WIDTH 1920
+#define BENCHMARK_HEIGHT 1080
+
+#define BENCHMARK_SCREEN_WIDTH 3840
+#define BENCHMARK_SCREEN_HEIGHT 2160
+#define BENCHMARK_WINDOWS 48
+
+// Commands about a random window per run of the window lookup benchmark
+#define BENCHMARK_LOOKUPS 1024
+// Points and rectangles per run of the hit testing benchmark
+#define BENCHMARK_HITS 1024
+// How long the compositor of the window changes benchmark draws a frame
+#define BENCHMARK_FRAME_MICROSECONDS 8000
+// Windows added or removed per run of the window changes benchmark
+#define BENCHMARK_CHANGES 100
+// Screen-sized windows created per run of the window creation benchmark
+#define BENCHMARK_CREATED_WINDOWS 8
+
+// Runs `function` until `BENCHMARK_MIN_SECONDS` have passed and returns the
+// average time of one run, in seconds.
+template<typename F>
+static double measure(F&& function)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto runs = 0;
+    double elapsed;
+    do {
+        function();
+        runs += 1;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < BENCHMARK_MIN_SECONDS);
+    return elapsed / runs;
+}
+
+static bool benchmarkBlendKernels() noexcept(true)
+{
+    auto pixels = BENCHMARK_WIDTH * BENCHMARK_HEIGHT;
+    std::vector<uint8_t> dst(pixels * COMPONENTS);
+    std::vector<uint8_t> translucent(pixels * COMPONENTS);
+    std::vector<uint8_t> opaque(pixels * COMPONENTS);
+
+    std::mt19937 rng(420);
+    for (size_t i = 0; i < translucent.size(); ++i) {
+        translucent[i] = rng();
+        opaque[i] = (i % COMPONENTS == 3) ? 255 : translucent[i];
+    }
+
+    auto ok = true;
+    std::cout << "[BENCH] Blending kernels (" << BENCHMARK_WIDTH << "x" << BENCHMARK_HEIGHT
+              << ", megapixels per second):\n";
+    std::printf("    %-10s %-8s %12s %12s %12s %12s\n",
+        "kernels", "exact", "blend", "blend opaque", "copy", "fill");
+
+    auto kernelsList = availableBlendKernels();
+    kernelsList.insert(kernelsList.begin(), &referenceBlendKernels());
+    for (auto kernels : kernelsList) {
+        auto mismatches = verifyBlendKernels(*kernels);
+        ok = ok && mismatches == 0;
+
+        auto row = [&](auto&& kernel) {
+            return pixels / measure([&] {
+                for (auto y = 0; y < BENCHMARK_HEIGHT; ++y) {
+                    kernel(y * BENCHMARK_WIDTH * COMPONENTS);
+                }
+            }) / 1e6;
+        };
+        auto blend = row([&](int offset) {
+            kernels->blend(dst.data() + offset, translucent.data() + offset, BENCHMARK_WIDTH);
+        });
+        auto blendOpaque = row([&](int offset) {
+            kernels->blend(dst.data() + offset, opaque.data() + offset, BENCHMARK_WIDTH);
+        });
+        auto copy = row([&](int offset) {
+            kernels->copy(dst.data() + offset, opaque.data() + offset, BENCHMARK_WIDTH);
+        });
+        auto fill = row([&](int offset) {
+            kernels->fill(dst.data() + offset, 0xFF181818, BENCHMARK_WIDTH);
+        });
+
+        std::printf("    %-10s %-8s %12.1f %12.1f %12.1f %12.1f\n", kernels->name,
+            mismatches == 0 ? "yes" : "NO", blend, blendOpaque, copy, fill);
+    }
+
+    std::cout << "[BENCH] Compositor uses `" << blendKernels().name << "` kernels\n";
+    return ok;
+}
+
+// Windows that are not backed by shared memory, for benchmarks only.
+// One in three windows is translucent.
+static std::vector<Window*> createWindows(int count, int screenWidth, int screenHeight,
+    std::vector<std::vector<uint8_t>>& buffers) noexcept(true)
+{
+    std::mt19937 rng(1337);
+    std::vector<Window*> windows;
+    for (auto i = 0; i < count; ++i) {
+        auto w = new Window();
+        w->m_id = i + 1;
+        w->m_area.width = 300 + rng() % 1100;
+        w->m_area.height = 200 + rng() % 700;
+        w->m_area.x = rng() % (int)(screenWidth - w->m_area.width);
+        w->m_area.y = TITLEBAR_THICKNESS + rng() % (int)(screenHeight - w->m_area.height - TITLEBAR_THICKNESS);
+
+        auto& buffer = buffers.emplace_back(w->m_area.width * w->m_area.height * COMPONENTS);
+        for (size_t j = 0; j < buffer.size(); ++j) {
+            buffer[j] = (j % COMPONENTS == 3 && i % 3 != 0) ? 255 : rng();
+        }
+        w->m_pixels = buffer.data();
+        windows.push_back(w);
+    }
+    return windows;
+}
+
+static void benchmarkTiledCompositing() noexcept(true)
+{
+    auto res = Framebuffer::create(BENCHMARK_SCREEN_WIDTH, BENCHMARK_SCREEN_HEIGHT, "");
+    if (!res.isOk())
+        return;
+    auto framebuffer = res.getValue();
+
+    std::vector<std::vector<uint8_t>> buffers;
+    auto windows = createWindows(BENCHMARK_WINDOWS, BENCHMARK_SCREEN_WIDTH, BENCHMARK_SCREEN_HEIGHT, buffers);
+
+    std::cout << "[BENCH] Tiled compositing (" << BENCHMARK_SCREEN_WIDTH << "x" << BENCHMARK_SCREEN_HEIGHT
+              << ", " << BENCHMARK_WINDOWS << " windows, " << COMPOSITOR_TILE_SIZE << "px tiles):\n";
+    std::printf("    %-8s %12s %10s\n", "threads", "frame (ms)", "speedup");
+
+    int hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<int> threadCounts;
+    for (auto threads = 1; threads < hardwareThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(hardwareThreads);
+
+    double singleThreaded = 0;
+    for (auto threads : threadCounts) {
+        SoftwareCompositor compositor(framebuffer, threads);
+        auto frame = measure([&] { compositor.compose(windows); });
+        if (threads == 1)
+            singleThreaded = frame;
+        std::printf("    %-8d %12.2f %9.2fx\n", threads, frame * 1e3, singleThreaded / frame);
+    }
+
+    for (auto w : windows) {
+        delete w;
+    }
+    framebuffer->destroy();
+}
+
+// A keyboard driven by the benchmark, in the way raylib reports it
+struct FakeKeyboard {
+    std::deque<int> pressed;
+    std::vector<bool> down = std::vector<bool>(KEY_CODE_MAX);
+    std::vector<bool> previous = std::vector<bool>(KEY_CODE_MAX);
+
+    int nextPressed()
+    {
+        if (pressed.empty())
+            return 0;
+        auto key = pressed.front();
+        pressed.pop_front();
+        return key;
+    }
+
+    void press(int key)
+    {
+        pressed.push_back(key);
+        down[key] = true;
+    }
+};
+
+static bool checkInputSampler() noexcept(true)
+{
+    FakeKeyboard keyboard;
+    InputSampler sampler;
+    std::vector<KeyTransition> transitions;
+    auto frame = [&] {
+        transitions.clear();
+        sampler.sample([&] { return keyboard.nextPressed(); }, [&](int key) { return (bool)keyboard.down[key]; },
+            transitions);
+    };
+    auto expect = [&](std::vector<KeyTransition> expected) {
+        if (transitions.size() != expected.size())
+            return false;
+        for (size_t i = 0; i < expected.size(); ++i) {
+            if (transitions[i].key != expected[i].key || transitions[i].pressed != expected[i].pressed)
+                return false;
+        }
+        return true;
+    };
+
+    auto ok = true;
+    frame();
+    ok = ok && expect({ });
+
+    keyboard.press(RDKEY_A);
+    frame();
+    ok = ok && expect({ { RDKEY_A, true } });
+
+    // Held down
+    frame();
+    ok = ok && expect({ });
+
+    keyboard.down[RDKEY_A] = false;
+    keyboard.press(RDKEY_LEFT_SHIFT);
+    keyboard.press(RDKEY_B);
+    frame();
+    ok = ok && expect({ { RDKEY_A, false }, { RDKEY_LEFT_SHIFT, true }, { RDKEY_B, true } });
+
+    // Tapped within a frame, and not a key
+    keyboard.press(RDKEY_C);
+    keyboard.down[RDKEY_C] = false;
+    keyboard.press(5);
+    frame();
+    ok = ok && expect({ { RDKEY_C, true } });
+
+    keyboard.down[RDKEY_B] = false;
+    keyboard.press(RDKEY_LEFT_SHIFT);
+    frame();
+    ok = ok && expect({ { RDKEY_C, false }, { RDKEY_B, false }, { RDKEY_LEFT_SHIFT, false },
+                          { RDKEY_LEFT_SHIFT, true } });
+
+    return ok;
+}
+
+static bool benchmarkInputSampling() noexcept(true)
+{
+    auto ok = checkInputSampler();
+
+    FakeKeyboard keyboard;
+    InputSampler sampler;
+    std::vector<KeyTransition> transitions;
+
+    // What the render loop used to do: ask every key whether it was pressed or released
+    auto scan = [&] {
+        transitions.clear();
+        for (auto key = 0; key < KEY_CODE_MAX; ++key) {
+            if (!isKnownKey(key))
+                continue;
+            if (keyboard.down[key] && !keyboard.previous[key])
+                transitions.push_back(KeyTransition { (RudeDrawerKey)key, true });
+            else if (!keyboard.down[key] && keyboard.previous[key])
+                transitions.push_back(KeyTransition { (RudeDrawerKey)key, false });
+        }
+        keyboard.previous = keyboard.down;
+    };
+    auto sample = [&] {
+        transitions.clear();
+        sampler.sample([&] { return keyboard.nextPressed(); }, [&](int key) { return (bool)keyboard.down[key]; },
+            transitions);
+    };
+    // Four keys held down, one of them pressed and released on every frame
+    auto typing = [&](auto&& step) {
+        return [&, step] {
+            keyboard.press(RDKEY_T);
+            step();
+            keyboard.down[RDKEY_T] = false;
+            step();
+        };
+    };
+
+    std::cout << "[BENCH] Input sampling (nanoseconds per frame):\n";
+    std::printf("    %-10s %-8s %12s %12s\n", "sampler", "exact", "idle", "typing");
+
+    auto scanIdle = measure(scan) * 1e9;
+    for (auto key : { RDKEY_LEFT_SHIFT, RDKEY_W, RDKEY_A, RDKEY_D }) {
+        keyboard.press(key);
+    }
+    scan();
+    auto scanTyping = measure(typing(scan)) / 2 * 1e9;
+    std::printf("    %-10s %-8s %12.1f %12.1f\n", "scan", "-", scanIdle, scanTyping);
+
+    keyboard = FakeKeyboard { };
+    auto sampleIdle = measure(sample) * 1e9;
+    for (auto key : { RDKEY_LEFT_SHIFT, RDKEY_W, RDKEY_A, RDKEY_D }) {
+        keyboard.press(key);
+    }
+    sample();
+    auto sampleTyping = measure(typing(sample)) / 2 * 1e9;
+    std::printf("    %-10s %-8s %12.1f %12.1f\n", "queue", ok ? "yes" : "NO", sampleIdle, sampleTyping);
+
+    return ok;
+}
+
+static bool checkWindowTable() noexcept(true)
+{
+    Window windows[4];
+    for (auto i = 0; i < 4; ++i) {
+        windows[i].m_id = i + 1;
+    }
+
+    Epochs epochs;
+    WindowTable table;
+    table.insert(&windows[0]);
+    table.insert(&windows[1]);
+    table.insert(&windows[2]);
+
+    auto ok = true;
+    ok = ok && table.remove(2) == &windows[1] && table.remove(2) == nullptr && table.find(2) == nullptr;
+
+    // Reuses the slot of the removed window
+    table.insert(&windows[3]);
+    ok = ok && table.find(4) == &windows[3] && table.find(2) == nullptr;
+
+    ok = ok && table.raise(1) && !table.raise(2) && table.top() == &windows[0];
+    ok = ok && table.snapshot().empty();
+    table.publish(epochs);
+    ok = ok && table.snapshot() == std::vector<Window*> { &windows[2], &windows[3], &windows[0] };
+    ok = ok && table.find(3) == &windows[2] && table.find(1) == &windows[0] && table.size() == 3;
+
+    ok = ok && table.remove(1) == &windows[0] && table.top() == &windows[3];
+    table.publish(epochs);
+    ok = ok && table.snapshot() == std::vector<Window*> { &windows[2], &windows[3] };
+    return ok;
+}
+
+static bool benchmarkWindowLookup() noexcept(true)
+{
+    auto ok = checkWindowTable();
+
+    std::cout << "[BENCH] Window lookup (nanoseconds per command):\n";
+    std::printf("    %-8s %-8s %12s %12s %12s %12s\n", "windows", "exact", "scan", "table", "move to top", "raise");
+
+    for (auto count : { 10, 100, 1000, 10000 }) {
+        std::vector<Window*> windows;
+        WindowTable table;
+        for (auto i = 0; i < count; ++i) {
+            auto w = new Window();
+            w->m_id = i + 1;
+            windows.push_back(w);
+            table.insert(w);
+        }
+
+        std::mt19937 rng(4242);
+        std::vector<uint32_t> ids(BENCHMARK_LOOKUPS);
+        for (auto& id : ids) {
+            id = rng() % count + 1;
+        }
+
+        // Kept so that the lookups are not optimized away
+        uint64_t scanned = 0;
+        uint64_t found = 0;
+
+        // What `AppDrawer::findWindow()` used to do
+        auto scan = measure([&] {
+            for (auto id : ids) {
+                for (auto w : windows) {
+                    if (w->m_id == id) {
+                        scanned += w->m_id;
+                        break;
+                    }
+                }
+            }
+        });
+        auto lookup = measure([&] {
+            for (auto id : ids) {
+                found += table.find(id)->m_id;
+            }
+        });
+
+        // What `AppDrawer::changeActiveWindow()` used to do
+        auto moveToTop = measure([&] {
+            for (auto id : ids) {
+                auto it = std::find_if(windows.begin(), windows.end(), [&](Window* w) { return w->m_id == id; });
+                auto window = *it;
+                windows.erase(it);
+                windows.push_back(window);
+            }
+        });
+        auto raise = measure([&] {
+            for (auto id : ids) {
+                table.raise(id);
+            }
+        });
+
+        auto exact = scanned != 0 && found != 0 && table.top()->m_id == ids.back()
+            && windows.back()->m_id == ids.back() && table.size() == (size_t)count;
+        ok = ok && exact;
+
+        std::printf("    %-8d %-8s %12.1f %12.1f %12.1f %12.1f\n", count, exact ? "yes" : "NO",
+            scan / BENCHMARK_LOOKUPS * 1e9, lookup / BENCHMARK_LOOKUPS * 1e9,
+            moveToTop / BENCHMARK_LOOKUPS * 1e9, raise / BENCHMARK_LOOKUPS * 1e9);
+
+        for (auto w : windows) {
+            delete w;
+        }
+    }
+
+    return ok;
+}
+
+// What the focus loop used to do, with `windows` from bottom to top
+static Window* scanTopmostAt(std::vector<Window*> const& windows, Vector2 point) noexcept(true)
+{
+    for (auto i = windows.size(); i-- > 0;) {
+        if (CheckCollisionPointRec(point, decorationBounds(windows[i]->m_area)))
+            return windows[i];
+    }
+    return nullptr;
+}
+
+static bool benchmarkHitTesting() noexcept(true)
+{
+    auto ok = true;
+
+    std::cout << "[BENCH] Hit testing (" << BENCHMARK_SCREEN_WIDTH << "x" << BENCHMARK_SCREEN_HEIGHT
+              << ", " << WINDOW_GRID_CELL_SIZE << "px cells, nanoseconds per query):\n";
+    std::printf("    %-8s %-8s %12s %12s\n", "windows", "exact", "point scan", "point grid");
+
+    for (auto count : { 10, 100, 1000, 10000 }) {
+        std::mt19937 rng(99);
+        WindowTable table;
+        WindowGrid grid(BENCHMARK_SCREEN_WIDTH, BENCHMARK_SCREEN_HEIGHT);
+
+        // A wall of windows overlapping their neighbours, some of them past the edges
+        auto side = (int)std::ceil(std::sqrt(count));
+        auto width = BENCHMARK_SCREEN_WIDTH / side;
+        auto height = BENCHMARK_SCREEN_HEIGHT / side;
+        for (auto i = 0; i < count; ++i) {
+            auto w = new Window();
+            w->m_id = i + 1;
+            w->m_area.width = width / 2 + rng() % width;
+            w->m_area.height = height / 2 + rng() % height;
+            w->m_area.x = (float)(i % side * width) - width / 4 + rng() % (width / 2 + 1);
+            w->m_area.y = (float)(i / side * height) - height / 4 + rng() % (height / 2 + 1);
+            table.insert(w);
+            grid.insert(w);
+        }
+
+        auto randomPoint = [&] {
+            return Vector2 { (float)(rng() % (BENCHMARK_SCREEN_WIDTH + 200)) - 100,
+                (float)(rng() % (BENCHMARK_SCREEN_HEIGHT + 200)) - 100 };
+        };
+
+        // Shuffled by raising, moving and removing windows, then checked against a scan
+        for (auto i = 0; i < count / 4; ++i) {
+            auto id = rng() % count + 1;
+            auto w = table.find(id);
+            if (w == nullptr)
+                continue;
+            if (i % 3 == 0) {
+                table.raise(id);
+            } else if (i % 3 == 1) {
+                w->m_area.x += (float)(rng() % 601) - 300;
+                w->m_area.y += (float)(rng() % 601) - 300;
+                grid.update(w);
+            } else {
+                grid.remove(table.remove(id));
+                delete w;
+            }
+        }
+
+        Epochs epochs;
+        table.publish(epochs);
+        auto& windows = table.snapshot();
+        auto exact = true;
+        for (auto i = 0; i < BENCHMARK_HITS; ++i) {
+            auto point = randomPoint();
+            exact = exact && grid.topmostAt(point) == scanTopmostAt(windows, point);
+        }
+        ok = ok && exact;
+
+        std::vector<Vector2> points(BENCHMARK_HITS);
+        for (auto& point : points) {
+            point = randomPoint();
+        }
+
+        // Kept so that the queries are not optimized away
+        uint64_t hits = 0;
+        auto pointScan = measure([&] {
+            for (auto point : points) {
+                hits += scanTopmostAt(windows, point) != nullptr;
+            }
+        });
+        auto pointGrid = measure([&] {
+            for (auto point : points) {
+                hits += grid.topmostAt(point) != nullptr;
+            }
+        });
+        ok = ok && hits != 0;
+
+        std::printf("    %-8d %-8s %12.1f %12.1f\n", count, exact ? "yes" : "NO",
+            pointScan / BENCHMARK_HITS * 1e9, pointGrid / BENCHMARK_HITS * 1e9);
+
+        for (auto w : windows) {
+            delete w;
+        }
+    }
+
+    return ok;
+}
+
+static bool checkEpochs() noexcept(true)
+{
+    Epochs epochs;
+    auto reclaimed = 0;
+    auto ok = true;
+    {
+        EpochGuard outer(epochs);
+        epochs.retire([&] { ++reclaimed; });
+        {
+            EpochGuard inner(epochs);
+        }
+        // Still read by the outer guard
+        ok = ok && epochs.reclaim() == 0 && reclaimed == 0;
+    }
+    ok = ok && epochs.reclaim() == 1 && reclaimed == 1;
+
+    // Held back by a reader on another thread until it is done
+    std::atomic<int> step = 0;
+    std::thread reader([&] {
+        EpochGuard guard(epochs);
+        step = 1;
+        while (step != 2) {
+            std::this_thread::yield();
+        }
+    });
+    while (step != 1) {
+        std::this_thread::yield();
+    }
+    epochs.retire([&] { ++reclaimed; });
+    ok = ok && epochs.reclaim() == 0 && reclaimed == 1;
+    step = 2;
+    reader.join();
+    ok = ok && epochs.reclaim() == 1 && reclaimed == 2;
+    return ok;
+}
+
+// The AppDrawer the benchmarks send commands to, created on first use. It does
+// not listen, and lives as long as the process, like the threads of its reactor.
+// What it prints about every command is dropped from then on, the benchmarks
+// print with `std::printf()`.
+static AppDrawer* benchmarkAppDrawer() noexcept(false)
+{
+    static AppDrawer* appdrawer = nullptr;
+    if (appdrawer == nullptr) {
+        std::cout.flush();
+        std::cout.rdbuf(nullptr);
+        appdrawer = new AppDrawer(BENCHMARK_SCREEN_WIDTH, BENCHMARK_SCREEN_HEIGHT, 1, false);
+    }
+    return appdrawer;
+}
+
+// A client of `benchmarkAppDrawer()` speaking version 2 of the protocol through
+// a socket pair, waiting for the response to every command.
+class BenchmarkClient {
+private:
+    int m_fd = -1;
+    uint32_t m_requestId = 0;
+
+    bool sendAll(void const* data, size_t size) noexcept(true)
+    {
+        auto bytes = (uint8_t const*)data;
+        while (size > 0) {
+            auto sent = send(m_fd, bytes, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    // Closes the file descriptors passed along with the bytes.
+    bool receiveAll(void* data, size_t size) noexcept(true)
+    {
+        auto bytes = (uint8_t*)data;
+        while (size > 0) {
+            iovec iov = { bytes, size };
+            alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))];
+            msghdr message = { };
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            auto received = recvmsg(m_fd, &message, MSG_CMSG_CLOEXEC);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                return false;
+            for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+                if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                    continue;
+                auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; ++i) {
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+                    ::close(fd);
+                }
+            }
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+
+public:
+    BenchmarkClient() noexcept(false)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+            throw std::runtime_error(std::string("ERROR: could not open socket pair: ") + strerror(errno));
+        // Only the end of the server is non-blocking
+        if (fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK) == -1
+            || !benchmarkAppDrawer()->addClient(fds[0])) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            throw std::runtime_error("ERROR: could not add the benchmark client");
+        }
+        m_fd = fds[1];
+
+        RudeDrawerHello hello = { PROTOCOL_MAGIC, PROTOCOL_VERSION };
+        if (!sendAll(&hello, sizeof(hello)) || !receiveAll(&hello, sizeof(hello)) || hello.version != PROTOCOL_VERSION)
+            throw std::runtime_error("ERROR: could not negotiate with the benchmark AppDrawer");
+    }
+
+    ~BenchmarkClient() noexcept(true)
+    {
+        ::close(m_fd);
+    }
+
+    BenchmarkClient(BenchmarkClient const&) = delete;
+    BenchmarkClient& operator=(BenchmarkClient const&) = delete;
+
+    // Sends a command that has no response.
+    void post(RudeDrawerCommand const& command) noexcept(false)
+    {
+        std::vector<uint8_t> message;
+        encodeCommand(command, ++m_requestId, message);
+        if (!sendAll(message.data(), message.size()))
+            throw std::runtime_error("ERROR: could not send a command to the benchmark AppDrawer");
+    }
+
+    RudeDrawerResponse request(RudeDrawerCommand const& command) noexcept(false)
+    {
+        post(command);
+
+        RudeDrawerMessageHeader header;
+        std::vector<uint8_t> payload;
+        RudeDrawerResponse response;
+        if (!receiveAll(&header, sizeof(header)))
+            throw std::runtime_error("ERROR: could not receive a response from the benchmark AppDrawer");
+        payload.resize(header.length);
+        if (!receiveAll(payload.data(), payload.size()) || header.requestId != m_requestId
+            || !decodeResponse(header, payload.data(), response))
+            throw std::runtime_error("ERROR: could not receive a response from the benchmark AppDrawer");
+        return response;
+    }
+
+    // Returns the ID of the window, 0 if it could not be added.
+    uint32_t addWindow(int width, int height, uint32_t bufferCount) noexcept(false)
+    {
+        RudeDrawerCommand command;
+        std::memset(&command, 0, sizeof(command));
+        command.kind = RDCMD_ADD_WIN;
+        command.windowDims = { width, height };
+        command.windowBufferCount = bufferCount;
+        std::strcpy((char*)command.windowTitle, "bench");
+        auto response = request(command);
+        return response.errorKind == RDERROR_OK ? response.windowId : 0;
+    }
+
+    bool removeWindow(uint32_t id) noexcept(false)
+    {
+        RudeDrawerCommand command;
+        std::memset(&command, 0, sizeof(command));
+        command.kind = RDCMD_REMOVE_WIN;
+        command.windowId = id;
+        return request(command).errorKind == RDERROR_OK;
+    }
+};
+
+// Adds and removes windows through the commands of AppDrawer while another
+// thread draws `AppDrawer::windows()` and reclaims the removed ones, as the
+// render loop does. The windows are locked for the whole frame as it used to
+// do, or only pinned.
+static bool benchmarkWindowChanges() noexcept(true)
+{
+    auto ok = checkEpochs();
+
+    std::printf("[BENCH] Window changes while frames take %d ms (microseconds per command):\n",
+        BENCHMARK_FRAME_MICROSECONDS / 1000);
+    std::printf("    %-8s %-8s %12s %12s\n", "frames", "exact", "average", "worst");
+
+    auto appdrawer = benchmarkAppDrawer();
+    BenchmarkClient client;
+    for (auto pinned : { false, true }) {
+        std::atomic<bool> done = false;
+        // Kept so that the reads are not optimized away
+        std::atomic<uint64_t> drawn = 0;
+
+        std::thread render([&] {
+            while (!done) {
+                if (!pinned)
+                    appdrawer->lockWindows();
+                {
+                    EpochGuard guard(appdrawer->epochs());
+                    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(BENCHMARK_FRAME_MICROSECONDS);
+                    while (std::chrono::steady_clock::now() < end) {
+                        for (auto w : appdrawer->windows()) {
+                            drawn += w->m_id;
+                        }
+                    }
+                }
+                if (!pinned)
+                    appdrawer->unlockWindows();
+
+                // The input is still handled with the windows locked
+                appdrawer->lockWindows();
+                appdrawer->unlockWindows();
+                appdrawer->reclaimWindows();
+            }
+        });
+
+        std::vector<uint32_t> windows;
+        std::vector<double> latencies;
+        std::mt19937 rng(7);
+        for (auto i = 0; i < BENCHMARK_CHANGES; ++i) {
+            std::this_thread::sleep_for(std::chrono::microseconds(rng() % 2000));
+
+            auto start = std::chrono::steady_clock::now();
+            if (i % 3 != 2 || windows.empty()) {
+                auto id = client.addWindow(64, 64, 1);
+                ok = ok && id != 0;
+                windows.push_back(id);
+            } else {
+                auto index = rng() % windows.size();
+                ok = client.removeWindow(windows[index]) && ok;
+                windows.erase(windows.begin() + index);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            latencies.push_back(elapsed.count());
+        }
+        done = true;
+        render.join();
+
+        auto average = 0.0;
+        for (auto latency : latencies) {
+            average += latency / latencies.size();
+        }
+        auto worst = *std::max_element(latencies.begin(), latencies.end());
+
+        // The published windows are those the commands left, from bottom to top
+        std::vector<uint32_t> published;
+        {
+            EpochGuard guard(appdrawer->epochs());
+            for (auto w : appdrawer->windows()) {
+                published.push_back(w->m_id);
+            }
+        }
+        auto exact = drawn != 0 && published == windows;
+        ok = ok && exact;
+        std::printf("    %-8s %-8s %12.1f %12.1f\n", pinned ? "pinned" : "locked", exact ? "yes" : "NO",
+            average * 1e6, worst * 1e6);
+
+        for (auto id : windows) {
+            client.removeWindow(id);
+        }
+        appdrawer->reclaimWindows();
+    }
+
+    return ok;
+}
+
+// Creates screen-sized windows through the commands of AppDrawer, while another
+// thread plays the render loop and a second client pings. Neither should wait
+// for the buffers of the windows to be prepared.
+static bool benchmarkWindowCreation() noexcept(true)
+{
+    auto ok = true;
+
+    std::printf("[BENCH] Creating %d windows of %dx%d (microseconds frames and pings wait):\n",
+        BENCHMARK_CREATED_WINDOWS, BENCHMARK_SCREEN_WIDTH, BENCHMARK_SCREEN_HEIGHT);
+    std::printf("    %-8s %-8s %12s %12s %12s\n", "buffers", "created", "frame avg", "frame worst", "ping worst");
+
+    auto appdrawer = benchmarkAppDrawer();
+    BenchmarkClient client;
+    BenchmarkClient pinger;
+    for (auto bufferCount : { 1, 3 }) {
+        std::atomic<bool> done = false;
+        std::vector<double> waits;
+        std::vector<double> pings;
+
+        std::thread render([&] {
+            while (!done) {
+                auto start = std::chrono::steady_clock::now();
+                appdrawer->lockWindows();
+                appdrawer->unlockWindows();
+                std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+                waits.push_back(waited.count());
+
+                {
+                    EpochGuard guard(appdrawer->epochs());
+                    appdrawer->windows();
+                }
+                appdrawer->reclaimWindows();
+                std::this_thread::sleep_for(std::chrono::microseconds(BENCHMARK_FRAME_MICROSECONDS / 2));
+            }
+        });
+        std::thread ping([&] {
+            RudeDrawerCommand command;
+            std::memset(&command, 0, sizeof(command));
+            command.kind = RDCMD_PING;
+            while (!done) {
+                auto start = std::chrono::steady_clock::now();
+                pinger.request(command);
+                std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+                pings.push_back(waited.count());
+                std::this_thread::sleep_for(std::chrono::microseconds(BENCHMARK_FRAME_MICROSECONDS / 8));
+            }
+        });
+
+        std::vector<uint32_t> windows;
+        for (auto i = 0; i < BENCHMARK_CREATED_WINDOWS; ++i) {
+            auto id = client.addWindow(BENCHMARK_SCREEN_WIDTH, BENCHMARK_SCREEN_HEIGHT, bufferCount);
+            if (id != 0)
+                windows.push_back(id);
+            std::this_thread::sleep_for(std::chrono::microseconds(BENCHMARK_FRAME_MICROSECONDS));
+        }
+        done = true;
+        render.join();
+        ping.join();
+        ok = ok && windows.size() == BENCHMARK_CREATED_WINDOWS;
+
+        auto average = 0.0;
+        for (auto wait : waits) {
+            average += wait / waits.size();
+        }
+        auto worst = *std::max_element(waits.begin(), waits.end());
+        auto pingWorst = *std::max_element(pings.begin(), pings.end());
+        std::printf("    %-8d %-8zu %12.1f %12.1f %12.1f\n", bufferCount, windows.size(),
+            average * 1e6, worst * 1e6, pingWorst * 1e6);
+
+        for (auto id : windows) {
+            client.removeWindow(id);
+        }
+        appdrawer->reclaimWindows();
+    }
+
+    return ok;
+}
+
+// Sends commands about random windows to AppDrawer, as it holds more and more
+// of them. They should take as long with any number of windows.
+static bool benchmarkCommandLatency() noexcept(true)
+{
+    auto ok = true;
+
+    std::printf("[BENCH] Commands about a window through AppDrawer (microseconds per round trip):\n");
+    std::printf("    %-8s %-8s %12s %12s\n", "windows", "exact", "mouse", "commit");
+
+    auto appdrawer = benchmarkAppDrawer();
+    BenchmarkClient client;
+    std::vector<uint32_t> windows;
+    std::mt19937 rng(4242);
+    for (auto count : { 10, 100, 1000, 10000 }) {
+        while (windows.size() < (size_t)count) {
+            auto id = client.addWindow(4, 4, 1);
+            if (id == 0)
+                break;
+            windows.push_back(id);
+        }
+
+        std::vector<uint32_t> ids(BENCHMARK_LOOKUPS);
+        for (auto& id : ids) {
+            id = windows[rng() % windows.size()];
+        }
+
+        RudeDrawerCommand command;
+        std::memset(&command, 0, sizeof(command));
+        auto exact = windows.size() == (size_t)count;
+        auto roundTrips = [&](RudeDrawerCommandKind kind) {
+            command.kind = kind;
+            return measure([&] {
+                for (auto id : ids) {
+                    command.windowId = id;
+                    exact = client.request(command).errorKind == RDERROR_OK && exact;
+                }
+            });
+        };
+        auto mouse = roundTrips(RDCMD_GET_MOUSE_POSITION);
+        auto commit = roundTrips(RDCMD_COMMIT_WIN);
+
+        // No window is found once removed
+        auto removed = windows.back();
+        windows.pop_back();
+        client.removeWindow(removed);
+        command.windowId = removed;
+        exact = exact && client.request(command).errorKind == RDERROR_INVALID_WINID;
+        ok = ok && exact;
+
+        std::printf("    %-8d %-8s %12.1f %12.1f\n", count, exact ? "yes" : "NO",
+            mouse / BENCHMARK_LOOKUPS * 1e6, commit / BENCHMARK_LOOKUPS * 1e6);
+    }
+
+    for (auto id : windows) {
+        client.removeWindow(id);
+    }
+    appdrawer->reclaimWindows();
+    return ok;
+}
+
+int runBenchmarks() noexcept(true)
+{
+    auto ok = true;
+    ok = benchmarkBlendKernels() && ok;
+    benchmarkTiledCompositing();
+
+    if (!ok) {
+        std::cerr << "ERROR: some kernels do not match the reference implementation\n";
+        return 1;
+    }
+
+    if (!benchmarkInputSampling()) {
+        std::cerr << "ERROR: the input sampler reported the wrong key transitions\n";
+        return 1;
+    }
+
+    if (!benchmarkWindowLookup()) {
+        std::cerr << "ERROR: the window table found the wrong windows\n";
+        return 1;
+    }
+
+    if (!benchmarkHitTesting()) {
+        std::cerr << "ERROR: the window grid found the wrong windows\n";
+        return 1;
+    }
+
+    if (!benchmarkWindowChanges()) {
+        std::cerr << "ERROR: the published windows do not match the commands\n";
+        return 1;
+    }
+
+    if (!benchmarkWindowCreation()) {
+        std::cerr << "ERROR: could not create the windows\n";
+        return 1;
+    }
+
+    if (!benchmarkCommandLatency()) {
+        std::cerr << "ERROR: AppDrawer found the wrong windows\n";
+        return 1;
+    }
+    return 0;
+}
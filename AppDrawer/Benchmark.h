@@ -0,0 +1,7 @@
+#pragma once
+
+// Benchmark.h - Self-checks and micro-benchmarks of the compositor, run with
+// `AppDrawer --benchmark`. Everything runs headless, no display is needed.
+
+// Returns the exit code of the process.
+int runBenchmarks() noexcept(true);
@@ -0,0 +1,356 @@
+#include "Blend.h"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    define BLEND_X86
+#    include <immintrin.h>
+#endif
+
+#include "RudeDrawer.h"
+
+// Reference
+
+static void blendRowReference(uint8_t* dst, uint8_t const* src, int count)
+{
+    for (auto i = 0; i < count * COMPONENTS; i += COMPONENTS) {
+        uint32_t alpha = src[i + 3];
+        for (auto c = 0; c < 3; ++c) {
+            // round(x / 255) == floor((2x + 255) / 510)
+            dst[i + c] = (2 * (src[i + c] * alpha + dst[i + c] * (255 - alpha)) + 255) / 510;
+        }
+        dst[i + 3] = alpha + (2 * dst[i + 3] * (255 - alpha) + 255) / 510;
+    }
+}
+
+static void copyRowReference(uint8_t* dst, uint8_t const* src, int count)
+{
+    for (auto i = 0; i < count * COMPONENTS; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+static void fillRowReference(uint8_t* dst, uint32_t color, int count)
+{
+    for (auto i = 0; i < count; ++i) {
+        std::memcpy(dst + i * COMPONENTS, &color, COMPONENTS);
+    }
+}
+
+// Scalar
+
+// Exact `round(x / 255)` for every `x` in [0, 65535]
+static inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline void blendPixel(uint8_t* dst, uint8_t const* src)
+{
+    uint32_t alpha = src[3];
+    if (alpha == 255) {
+        std::memcpy(dst, src, COMPONENTS);
+        return;
+    }
+    if (alpha == 0)
+        return;
+
+    dst[0] = div255(src[0] * alpha + dst[0] * (255 - alpha));
+    dst[1] = div255(src[1] * alpha + dst[1] * (255 - alpha));
+    dst[2] = div255(src[2] * alpha + dst[2] * (255 - alpha));
+    dst[3] = alpha + div255(dst[3] * (255 - alpha));
+}
+
+static void blendRowScalar(uint8_t* dst, uint8_t const* src, int count)
+{
+    for (auto i = 0; i < count; ++i) {
+        blendPixel(dst + i * COMPONENTS, src + i * COMPONENTS);
+    }
+}
+
+static void copyRowScalar(uint8_t* dst, uint8_t const* src, int count)
+{
+    std::memcpy(dst, src, count * COMPONENTS);
+}
+
+static void fillRowScalar(uint8_t* dst, uint32_t color, int count)
+{
+    for (auto i = 0; i < count; ++i) {
+        std::memcpy(dst + i * COMPONENTS, &color, COMPONENTS);
+    }
+}
+
+#ifdef BLEND_X86
+
+// SSE2
+// Pixels are widened to 16 bits per channel, two pixels per register half.
+// The source alpha lane is forced to 255, so that the alpha channel goes
+// through the same `src * a + dst * (255 - a)` formula as the colors.
+
+__attribute__((target("sse2"))) static inline __m128i blendHalfSse2(__m128i src, __m128i dst)
+{
+    auto const alphaLanes = _mm_set1_epi64x(0x00FF000000000000);
+    auto alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xFF), 0xFF);
+    auto inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+
+    auto x = _mm_add_epi16(_mm_mullo_epi16(_mm_or_si128(src, alphaLanes), alpha),
+        _mm_mullo_epi16(dst, inverse));
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("sse2"))) static void blendRowSse2(uint8_t* dst, uint8_t const* src, int count)
+{
+    auto const zero = _mm_setzero_si128();
+    auto const alphaBytes = _mm_set1_epi32(0xFF000000);
+
+    auto i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto s = _mm_loadu_si128((__m128i const*)(src + i * COMPONENTS));
+        auto alphas = _mm_and_si128(s, alphaBytes);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alphas, alphaBytes)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i*)(dst + i * COMPONENTS), s);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alphas, zero)) == 0xFFFF)
+            continue;
+
+        auto d = _mm_loadu_si128((__m128i const*)(dst + i * COMPONENTS));
+        auto lo = blendHalfSse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+        auto hi = blendHalfSse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+        _mm_storeu_si128((__m128i*)(dst + i * COMPONENTS), _mm_packus_epi16(lo, hi));
+    }
+
+    blendRowScalar(dst + i * COMPONENTS, src + i * COMPONENTS, count - i);
+}
+
+__attribute__((target("sse2"))) static void copyRowSse2(uint8_t* dst, uint8_t const* src, int count)
+{
+    auto i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto s = _mm_loadu_si128((__m128i const*)(src + i * COMPONENTS));
+        _mm_storeu_si128((__m128i*)(dst + i * COMPONENTS), s);
+    }
+
+    copyRowScalar(dst + i * COMPONENTS, src + i * COMPONENTS, count - i);
+}
+
+__attribute__((target("sse2"))) static void fillRowSse2(uint8_t* dst, uint32_t color, int count)
+{
+    auto const c = _mm_set1_epi32(color);
+
+    auto i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)(dst + i * COMPONENTS), c);
+    }
+
+    fillRowScalar(dst + i * COMPONENTS, color, count - i);
+}
+
+// AVX2
+// Same as SSE2 with eight pixels per iteration. Unpacking and packing both
+// work within 128-bit lanes, so pixels come back out in their original order.
+
+__attribute__((target("avx2"))) static inline __m256i blendHalfAvx2(__m256i src, __m256i dst)
+{
+    auto const alphaLanes = _mm256_set1_epi64x(0x00FF000000000000);
+    auto alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, 0xFF), 0xFF);
+    auto inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+
+    auto x = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_or_si256(src, alphaLanes), alpha),
+        _mm256_mullo_epi16(dst, inverse));
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2"))) static void blendRowAvx2(uint8_t* dst, uint8_t const* src, int count)
+{
+    auto const zero = _mm256_setzero_si256();
+    auto const alphaBytes = _mm256_set1_epi32(0xFF000000);
+
+    auto i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto s = _mm256_loadu_si256((__m256i const*)(src + i * COMPONENTS));
+        auto alphas = _mm256_and_si256(s, alphaBytes);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alphas, alphaBytes)) == -1) {
+            _mm256_storeu_si256((__m256i*)(dst + i * COMPONENTS), s);
+            continue;
+        }
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alphas, zero)) == -1)
+            continue;
+
+        auto d = _mm256_loadu_si256((__m256i const*)(dst + i * COMPONENTS));
+        auto lo = blendHalfAvx2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+        auto hi = blendHalfAvx2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+        _mm256_storeu_si256((__m256i*)(dst + i * COMPONENTS), _mm256_packus_epi16(lo, hi));
+    }
+
+    blendRowSse2(dst + i * COMPONENTS, src + i * COMPONENTS, count - i);
+}
+
+__attribute__((target("avx2"))) static void copyRowAvx2(uint8_t* dst, uint8_t const* src, int count)
+{
+    auto i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto s = _mm256_loadu_si256((__m256i const*)(src + i * COMPONENTS));
+        _mm256_storeu_si256((__m256i*)(dst + i * COMPONENTS), s);
+    }
+
+    copyRowSse2(dst + i * COMPONENTS, src + i * COMPONENTS, count - i);
+}
+
+__attribute__((target("avx2"))) static void fillRowAvx2(uint8_t* dst, uint32_t color, int count)
+{
+    auto const c = _mm256_set1_epi32(color);
+
+    auto i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)(dst + i * COMPONENTS), c);
+    }
+
+    fillRowSse2(dst + i * COMPONENTS, color, count - i);
+}
+
+#endif // BLEND_X86
+
+static BlendKernels const referenceKernels = {
+    .name = "reference",
+    .blend = blendRowReference,
+    .copy = copyRowReference,
+    .fill = fillRowReference,
+};
+
+static BlendKernels const scalarKernels = {
+    .name = "scalar",
+    .blend = blendRowScalar,
+    .copy = copyRowScalar,
+    .fill = fillRowScalar,
+};
+
+#ifdef BLEND_X86
+static BlendKernels const sse2Kernels = {
+    .name = "sse2",
+    .blend = blendRowSse2,
+    .copy = copyRowSse2,
+    .fill = fillRowSse2,
+};
+
+static BlendKernels const avx2Kernels = {
+    .name = "avx2",
+    .blend = blendRowAvx2,
+    .copy = copyRowAvx2,
+    .fill = fillRowAvx2,
+};
+#endif // BLEND_X86
+
+BlendKernels const& referenceBlendKernels() noexcept(true)
+{
+    return referenceKernels;
+}
+
+std::vector<BlendKernels const*> availableBlendKernels() noexcept(true)
+{
+    std::vector<BlendKernels const*> kernels = { &scalarKernels };
+
+#ifdef BLEND_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back(&sse2Kernels);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(&avx2Kernels);
+#endif // BLEND_X86
+
+    return kernels;
+}
+
+BlendKernels const& blendKernels() noexcept(true)
+{
+    static BlendKernels const* kernels = availableBlendKernels().back();
+    return *kernels;
+}
+
+static uint64_t countMismatches(std::vector<uint8_t> const& a, std::vector<uint8_t> const& b) noexcept(true)
+{
+    uint64_t mismatches = 0;
+    for (size_t i = 0; i < a.size(); i += COMPONENTS) {
+        if (std::memcmp(a.data() + i, b.data() + i, COMPONENTS) != 0)
+            mismatches += 1;
+    }
+    return mismatches;
+}
+
+uint64_t verifyBlendKernels(BlendKernels const& kernels) noexcept(true)
+{
+    auto const& reference = referenceBlendKernels();
+    uint64_t mismatches = 0;
+
+    // Every (source, destination, alpha) triple. Channels are scrambled so
+    // that each one sees different values within a pixel.
+    std::vector<uint8_t> src(256 * COMPONENTS);
+    std::vector<uint8_t> dst(256 * COMPONENTS);
+    for (auto d = 0; d < 256; ++d) {
+        dst[d * COMPONENTS + 0] = d;
+        dst[d * COMPONENTS + 1] = 255 - d;
+        dst[d * COMPONENTS + 2] = d ^ 0xA5;
+        dst[d * COMPONENTS + 3] = d;
+    }
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    for (auto alpha = 0; alpha < 256; ++alpha) {
+        for (auto s = 0; s < 256; ++s) {
+            for (auto i = 0; i < 256; ++i) {
+                src[i * COMPONENTS + 0] = s;
+                src[i * COMPONENTS + 1] = s ^ 0x5A;
+                src[i * COMPONENTS + 2] = 255 - s;
+                src[i * COMPONENTS + 3] = alpha;
+            }
+            expected = dst;
+            actual = dst;
+            reference.blend(expected.data(), src.data(), 256);
+            kernels.blend(actual.data(), src.data(), 256);
+            mismatches += countMismatches(expected, actual);
+        }
+    }
+
+    // Rows of every small size at every alignment, to exercise the tails and
+    // the fully opaque/transparent shortcuts
+    std::mt19937 rng(69);
+    for (auto count = 0; count < 70; ++count) {
+        for (auto offset = 0; offset < 8; ++offset) {
+            std::vector<uint8_t> row((count + offset) * COMPONENTS);
+            for (auto& byte : row) {
+                byte = rng();
+            }
+            src = row;
+            auto alphaMode = rng() % 3;
+            for (auto i = 3; i < (int)src.size(); i += COMPONENTS) {
+                src[i] = alphaMode == 0 ? 0 : alphaMode == 1 ? 255 : (uint8_t)rng();
+            }
+            uint32_t color = rng();
+
+            expected = row;
+            actual = row;
+            reference.blend(expected.data() + offset * COMPONENTS, src.data(), count);
+            kernels.blend(actual.data() + offset * COMPONENTS, src.data(), count);
+            mismatches += countMismatches(expected, actual);
+
+            expected = row;
+            actual = row;
+            reference.copy(expected.data() + offset * COMPONENTS, src.data(), count);
+            kernels.copy(actual.data() + offset * COMPONENTS, src.data(), count);
+            mismatches += countMismatches(expected, actual);
+
+            expected = row;
+            actual = row;
+            reference.fill(expected.data() + offset * COMPONENTS, color, count);
+            kernels.fill(actual.data() + offset * COMPONENTS, color, count);
+            mismatches += countMismatches(expected, actual);
+        }
+    }
+
+    return mismatches;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Blend.h - Pixel kernels used by the software compositor.
+// Every kernel works on a row of `count` RGBA pixels (`COMPONENTS` bytes each).
+//
+// Blending is "source over" with straight alpha, rounded exactly:
+//   dst.rgb = round((src.rgb * src.a + dst.rgb * (255 - src.a)) / 255)
+//   dst.a   = src.a + round(dst.a * (255 - src.a) / 255)
+// All the implementations return bit-exact results.
+
+typedef void (*BlendRowFunction)(uint8_t* dst, uint8_t const* src, int count);
+typedef void (*CopyRowFunction)(uint8_t* dst, uint8_t const* src, int count);
+// `color` is a pixel in memory order (`0xAABBGGRR` on little-endian).
+typedef void (*FillRowFunction)(uint8_t* dst, uint32_t color, int count);
+
+struct BlendKernels {
+    char const* name;
+    BlendRowFunction blend;
+    CopyRowFunction copy;
+    FillRowFunction fill;
+};
+
+// The straightforward per-channel implementation, every other kernel is
+// verified against it. Too slow to be used for compositing.
+BlendKernels const& referenceBlendKernels() noexcept(true);
+// All the kernels that can run on this CPU, slowest first.
+std::vector<BlendKernels const*> availableBlendKernels() noexcept(true);
+// The fastest kernels that can run on this CPU.
+BlendKernels const& blendKernels() noexcept(true);
+
+// Compares `kernels` against `referenceBlendKernels()` on every
+// source/destination/alpha combination, and on rows of odd sizes and
+// alignments. Returns the number of mismatching pixels.
+uint64_t verifyBlendKernels(BlendKernels const& kernels) noexcept(true);
@@ -0,0 +1,42 @@
+#include "Decoration.h"
+
+#include <raylib.h>
+
+Rectangle decorationBounds(Rectangle area) noexcept(true)
+{
+    area.y -= BORDER_THICKNESS + TITLEBAR_THICKNESS;
+    area.x -= BORDER_THICKNESS;
+    area.width += BORDER_THICKNESS * 2;
+    area.height += TITLEBAR_THICKNESS + BORDER_THICKNESS * 2;
+    return area;
+}
+
+Rectangle borderBounds(Rectangle area) noexcept(true)
+{
+    area.width += BORDER_THICKNESS * 2;
+    area.height += BORDER_THICKNESS * 2;
+    area.x -= BORDER_THICKNESS;
+    area.y -= BORDER_THICKNESS;
+    return area;
+}
+
+Rectangle titleBarBounds(Rectangle area) noexcept(true)
+{
+    return Rectangle {
+        .x = area.x - BORDER_THICKNESS,
+        .y = area.y - BORDER_THICKNESS - TITLEBAR_THICKNESS,
+        .width = area.width + BORDER_THICKNESS * 2,
+        .height = TITLEBAR_THICKNESS,
+    };
+}
+
+Rectangle closeButtonBounds(Rectangle area) noexcept(true)
+{
+    auto titleBarRect = titleBarBounds(area);
+    return Rectangle {
+        .x = titleBarRect.x,
+        .y = titleBarRect.y,
+        .width = TITLEBAR_THICKNESS,
+        .height = TITLEBAR_THICKNESS,
+    };
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <raylib.h>
+
+// Decoration.h - Geometry of the decorations (borders, title bar and close
+// button) drawn around every window. Shared by all the backends.
+
+#define BORDER_THICKNESS 5
+#define TITLEBAR_THICKNESS 20.0f
+
+// The area covered by a window and all of its decorations.
+Rectangle decorationBounds(Rectangle area) noexcept(true);
+// The area covered by the border, including the window itself.
+Rectangle borderBounds(Rectangle area) noexcept(true);
+Rectangle titleBarBounds(Rectangle area) noexcept(true);
+Rectangle closeButtonBounds(Rectangle area) noexcept(true);
@@ -0,0 +1,114 @@
+#include "Epochs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static std::atomic<uint64_t> nextEpochsId = 1;
+
+Epochs::Epochs() noexcept(true)
+{
+    m_id = nextEpochsId++;
+}
+
+Epochs::~Epochs() noexcept(true)
+{
+    for (auto& retired : m_retired) {
+        retired.reclaim();
+    }
+}
+
+Epochs::Reader* Epochs::reader() noexcept(false)
+{
+    // Threads read through a single domain, this is only looked up again in benchmarks
+    thread_local uint64_t cachedId = 0;
+    thread_local Reader* cachedReader = nullptr;
+    if (cachedId == m_id)
+        return cachedReader;
+
+    std::lock_guard<std::mutex> guard(m_readersMutex);
+
+    auto thread = std::this_thread::get_id();
+    auto it = std::find_if(m_readers.begin(), m_readers.end(),
+        [&](std::unique_ptr<Reader> const& reader) { return reader->thread == thread; });
+    if (it == m_readers.end()) {
+        m_readers.push_back(std::make_unique<Reader>());
+        m_readers.back()->thread = thread;
+        it = m_readers.end() - 1;
+    }
+
+    cachedId = m_id;
+    cachedReader = it->get();
+    return cachedReader;
+}
+
+void Epochs::enter() noexcept(false)
+{
+    auto reader = this->reader();
+    if (reader->depth++ > 0)
+        return;
+
+    // Anything the thread finds from now on was not unlinked before this epoch
+    reader->epoch.store(m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+}
+
+void Epochs::exit() noexcept(true)
+{
+    auto reader = this->reader();
+    if (--reader->depth > 0)
+        return;
+
+    // Released, so that the reads of the thread happen before any reclaiming
+    reader->epoch.store(0, std::memory_order_release);
+}
+
+void Epochs::retire(std::function<void()> reclaim) noexcept(false)
+{
+    // Readers announcing a later epoch started after the unlinking
+    auto epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst);
+
+    std::lock_guard<std::mutex> guard(m_retiredMutex);
+    m_retired.push_back(Retired { epoch, std::move(reclaim) });
+}
+
+size_t Epochs::reclaim() noexcept(false)
+{
+    auto oldest = UINT64_MAX;
+    {
+        std::lock_guard<std::mutex> guard(m_readersMutex);
+        for (auto& reader : m_readers) {
+            auto epoch = reader->epoch.load(std::memory_order_seq_cst);
+            if (epoch != 0)
+                oldest = std::min(oldest, epoch);
+        }
+    }
+
+    std::vector<Retired> ready;
+    {
+        std::lock_guard<std::mutex> guard(m_retiredMutex);
+        auto it = std::stable_partition(m_retired.begin(), m_retired.end(),
+            [&](Retired const& retired) { return retired.epoch >= oldest; });
+        std::move(it, m_retired.end(), std::back_inserter(ready));
+        m_retired.erase(it, m_retired.end());
+    }
+
+    // Called unlocked, they can retire more
+    for (auto& retired : ready) {
+        retired.reclaim();
+    }
+    return ready.size();
+}
+
+EpochGuard::EpochGuard(Epochs& epochs) noexcept(false)
+    : m_epochs(epochs)
+{
+    m_epochs.enter();
+}
+
+EpochGuard::~EpochGuard() noexcept(true)
+{
+    m_epochs.exit();
+}
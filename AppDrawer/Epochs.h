@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Epochs.h - Epoch-based reclamation, for what threads read without locking.
+// Readers announce the epoch they started reading in with an `EpochGuard`.
+// What a writer unlinks is retired at the current epoch, and reclaimed once no
+// reader announced that epoch or an older one, as only those can still see it.
+// Readers never wait, and writers never wait for readers: retired things only
+// live a little longer.
+
+class Epochs {
+private:
+    struct Reader {
+        std::thread::id thread;
+        // The announced epoch, 0 while the thread is not reading
+        alignas(64) std::atomic<uint64_t> epoch = 0;
+        // Guards of a thread nest, only the outermost one announces
+        uint32_t depth = 0;
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        std::function<void()> reclaim;
+    };
+
+    // Tells apart the domains cached by the threads, see `reader()`
+    uint64_t m_id;
+    std::atomic<uint64_t> m_epoch = 1;
+    std::mutex m_readersMutex;
+    std::vector<std::unique_ptr<Reader>> m_readers;
+    std::mutex m_retiredMutex;
+    std::vector<Retired> m_retired;
+
+    // The reader of the calling thread, registered on its first call.
+    Reader* reader() noexcept(false);
+
+public:
+    Epochs() noexcept(true);
+    // Reclaims everything, there must be no readers left.
+    ~Epochs() noexcept(true);
+
+    void enter() noexcept(false);
+    void exit() noexcept(true);
+
+    // Calls `reclaim` once no reader can see what was unlinked before this call.
+    void retire(std::function<void()> reclaim) noexcept(false);
+    // Calls what can be reclaimed now, and returns how many there were.
+    size_t reclaim() noexcept(false);
+};
+
+// Reads within an epoch of `epochs` for as long as it lives.
+class EpochGuard {
+private:
+    Epochs& m_epochs;
+
+public:
+    EpochGuard(Epochs& epochs) noexcept(false);
+    ~EpochGuard() noexcept(true);
+
+    EpochGuard(EpochGuard const&) = delete;
+    EpochGuard& operator=(EpochGuard const&) = delete;
+};
@@ -0,0 +1,257 @@
+#include "EventChannel.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "RudeDrawer.h"
+
+#include "ErrorHandling.h"
+
+// The most events sent to a window at once
+#define EVENT_BATCH_MAX 64
+
+EventChannel::EventChannel(Reactor* reactor, std::shared_ptr<EventRing> ring, int listenFd) noexcept(true)
+    : ReactorHandler(reactor->pickLoop())
+{
+    m_reactor = reactor;
+    m_ring = ring;
+    m_socket = ReactorSource { this, listenFd };
+    m_wake = ReactorSource { this, ring->wakeFd() };
+}
+
+Result<void*, void*> EventChannel::open(Reactor* reactor, uint32_t windowId,
+    std::shared_ptr<EventRing> ring) noexcept(true)
+{
+    std::string socketPath = "/tmp/APDWindowSock" + std::to_string(windowId);
+
+    if (unlink(socketPath.c_str()) != 0 && errno != ENOENT) {
+        std::cerr << "ERROR: could not remove `"
+                  << socketPath
+                  << "`: " << strerror(errno) << "\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "ERROR: could not open socket: `"
+                  << socketPath << "`\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    struct sockaddr_un serverAddr;
+    std::memset(&serverAddr, 0, sizeof(struct sockaddr_un));
+    serverAddr.sun_family = AF_UNIX;
+    std::strncpy(serverAddr.sun_path, socketPath.c_str(),
+        sizeof(serverAddr.sun_path) - 1);
+
+    if (bind(fd, (struct sockaddr*)&serverAddr, sizeof(struct sockaddr_un)) < 0) {
+        std::cerr << "ERROR: could not bind to socket: " << strerror(errno) << "\n";
+        ::close(fd);
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    auto channel = new EventChannel(reactor, ring, fd);
+    channel->m_path = socketPath;
+    struct stat pathStat;
+    if (stat(socketPath.c_str(), &pathStat) == 0)
+        channel->m_pathInode = pathStat.st_ino;
+
+    // The client can connect as soon as this returns, it is accepted later
+    if (listen(fd, 1) < 0) {
+        std::cerr << "ERROR: could not listen to socket: " << strerror(errno) << "\n";
+        channel->unlinkPath();
+        ::close(fd);
+        delete channel;
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    // Events pushed before the client connects wait in the ring
+    if (!reactor->add(&channel->m_wake, EPOLLIN)) {
+        channel->unlinkPath();
+        ::close(fd);
+        delete channel;
+        return Result<void*, void*>::fromError(nullptr);
+    }
+    if (!reactor->add(&channel->m_socket, EPOLLIN)) {
+        // The channel is already watching the ring, it closes once it stops,
+        // removing the socket file
+        ring->stop();
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    return Result<void*, void*>::fromValue(nullptr);
+}
+
+Result<void*, int> EventChannel::openPair(Reactor* reactor, std::shared_ptr<EventRing> ring) noexcept(true)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+        std::cerr << "ERROR: could not open socket pair: " << strerror(errno) << "\n";
+        return Result<void*, int>::fromError(nullptr);
+    }
+
+    // Only the end of the server is non-blocking
+    auto flags = fcntl(fds[0], F_GETFL);
+    if (flags == -1 || fcntl(fds[0], F_SETFL, flags | O_NONBLOCK) == -1) {
+        std::cerr << "ERROR: could not make socket non-blocking: " << strerror(errno) << "\n";
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return Result<void*, int>::fromError(nullptr);
+    }
+
+    auto channel = new EventChannel(reactor, ring, fds[0]);
+    channel->m_connected = true;
+    // The socket stays quiet until the client has its end, so it can go first
+    if (!reactor->add(&channel->m_socket, EPOLLIN)) {
+        ::close(fds[0]);
+        ::close(fds[1]);
+        delete channel;
+        return Result<void*, int>::fromError(nullptr);
+    }
+    if (!reactor->add(&channel->m_wake, EPOLLIN)) {
+        reactor->remove(&channel->m_socket);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        delete channel;
+        return Result<void*, int>::fromError(nullptr);
+    }
+    // There is no connection to accept, the loop starts delivering on its own
+    ring->wake();
+
+    return Result<void*, int>::fromValue(fds[1]);
+}
+
+void EventChannel::onReady(ReactorSource* source, uint32_t events) noexcept(true)
+{
+    if (source == &m_wake) {
+        m_ring->awake();
+        if (m_ring->stopped()) {
+            close();
+            return;
+        }
+        if (m_connected)
+            deliver();
+        return;
+    }
+
+    if (!m_connected) {
+        accept();
+        return;
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        std::cout << "[INFO] Event connection closed by client\n";
+        close();
+        return;
+    }
+
+    // The client never writes, anything readable means it hung up
+    if (events & EPOLLIN) {
+        uint8_t byte;
+        auto count = recv(m_socket.fd, &byte, sizeof(byte), 0);
+        if (count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR)) {
+            std::cout << "[INFO] Event connection closed by client\n";
+            close();
+            return;
+        }
+    }
+
+    if (events & EPOLLOUT) {
+        if (!flushNonBlocking(m_socket.fd, m_pending)) {
+            std::cerr << "ERROR: could not send events to the client: " << strerror(errno) << "\n";
+            close();
+            return;
+        }
+        if (m_pending.empty()) {
+            m_reactor->modify(&m_socket, EPOLLIN);
+            deliver();
+        }
+    }
+}
+
+void EventChannel::accept() noexcept(true)
+{
+    auto fd = accept4(m_socket.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            std::cerr << "ERROR: could not accept connection: " << strerror(errno) << "\n";
+        return;
+    }
+
+    // Nobody else can connect from now on
+    unlinkPath();
+    m_reactor->remove(&m_socket);
+    ::close(m_socket.fd);
+    m_socket.fd = fd;
+    m_connected = true;
+    if (!m_reactor->add(&m_socket, EPOLLIN)) {
+        close();
+        return;
+    }
+
+    deliver();
+}
+
+void EventChannel::deliver() noexcept(true)
+{
+    RudeDrawerEvent events[EVENT_BATCH_MAX];
+    while (m_pending.empty()) {
+        auto count = m_ring->pop(events, EVENT_BATCH_MAX);
+        if (count == 0) {
+            // Asleep until the next push, unless one raced with this
+            if (m_ring->sleep())
+                return;
+            continue;
+        }
+
+        // Everything that is pending goes out with a single `send()`
+        if (!sendNonBlocking(m_socket.fd, m_pending, events, count * sizeof(RudeDrawerEvent))) {
+            std::cerr << "ERROR: could not send events to the client: " << strerror(errno) << "\n";
+            close();
+            return;
+        }
+    }
+
+    // The rest is sent once the client reads, the ring holds new events meanwhile
+    m_reactor->modify(&m_socket, EPOLLIN | EPOLLOUT);
+}
+
+void EventChannel::unlinkPath() noexcept(true)
+{
+    if (m_path.empty())
+        return;
+
+    struct stat pathStat;
+    if (stat(m_path.c_str(), &pathStat) == 0 && pathStat.st_ino == m_pathInode) {
+        if (unlink(m_path.c_str()) != 0 && errno != ENOENT) {
+            std::cerr << "ERROR: could not remove `" << m_path
+                      << "`: " << strerror(errno) << "\n";
+        }
+    }
+    m_path.clear();
+}
+
+void EventChannel::close() noexcept(true)
+{
+    // The client never connected
+    unlinkPath();
+
+    // The window stops sending events if it still exists
+    m_ring->stop();
+
+    m_reactor->remove(&m_wake);
+    m_reactor->remove(&m_socket);
+    ::close(m_socket.fd);
+    m_reactor->retire(this);
+}
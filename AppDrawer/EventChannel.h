@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "EventRing.h"
+#include "Reactor.h"
+
+#include "ErrorHandling.h"
+
+// EventChannel.h - Delivers the events of a window to its client, through the
+// socket `/tmp/APDWindowSock<id>` or one end of a socket pair, on a reactor thread.
+// The channel listens until the client connects, and removes the socket file
+// then, or when it gives up. It sends what the render thread pushes to its
+// `EventRing`, as the socket takes it. It closes when the
+// ring is stopped or the client hangs up, which can be after the window is gone.
+
+class EventChannel : public ReactorHandler {
+private:
+    Reactor* m_reactor;
+    std::shared_ptr<EventRing> m_ring;
+    // Listening until the client connects, then connected to it
+    ReactorSource m_socket;
+    bool m_connected = false;
+    // The socket file while listening, empty once it is removed
+    std::string m_path;
+    // Tells the socket file apart from one bound later to the same path
+    ino_t m_pathInode = 0;
+    // The eventfd of the ring
+    ReactorSource m_wake;
+    // Events the socket could not take yet
+    std::vector<uint8_t> m_pending;
+
+    EventChannel(Reactor* reactor, std::shared_ptr<EventRing> ring, int listenFd) noexcept(true);
+
+    void accept() noexcept(true);
+    // Removes the socket file, unless another channel of the window replaced it.
+    void unlinkPath() noexcept(true);
+    // Sends the events of the ring until it is empty or the socket is full.
+    void deliver() noexcept(true);
+    void close() noexcept(true);
+
+public:
+    // Starts listening on the socket of window `windowId`, for events of `ring`.
+    static Result<void*, void*> open(Reactor* reactor, uint32_t windowId, std::shared_ptr<EventRing> ring) noexcept(true);
+    // Starts sending the events of `ring` through a socket pair, and returns the end
+    // of the client, that the caller owns.
+    static Result<void*, int> openPair(Reactor* reactor, std::shared_ptr<EventRing> ring) noexcept(true);
+
+    void onReady(ReactorSource* source, uint32_t events) noexcept(true) override;
+};
@@ -0,0 +1,109 @@
+#include "EventRing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "RudeDrawer.h"
+
+#include "ErrorHandling.h"
+
+EventRing::~EventRing() noexcept(true)
+{
+    if (m_wakeFd != -1)
+        close(m_wakeFd);
+}
+
+Result<void*, void*> EventRing::open() noexcept(true)
+{
+    m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeFd == -1) {
+        std::cerr << "ERROR: could not create eventfd: " << strerror(errno) << "\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+    return Result<void*, void*>::fromValue(nullptr);
+}
+
+int EventRing::wakeFd() const noexcept(true)
+{
+    return m_wakeFd;
+}
+
+bool EventRing::push(RudeDrawerEvent event) noexcept(true)
+{
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == EVENT_RING_SIZE)
+        return false;
+
+    m_events[tail % EVENT_RING_SIZE] = event;
+    // Sequentially consistent, so that either the consumer sees the event
+    // before going to sleep, or this sees that it went to sleep
+    m_tail.store(tail + 1, std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_seq_cst))
+        wake();
+    return true;
+}
+
+uint32_t EventRing::tail() const noexcept(true)
+{
+    return m_tail.load(std::memory_order_relaxed);
+}
+
+bool EventRing::consumed(uint32_t index) const noexcept(true)
+{
+    return (int32_t)(m_head.load(std::memory_order_acquire) - index) >= 0;
+}
+
+uint32_t EventRing::pop(RudeDrawerEvent* events, uint32_t max) noexcept(true)
+{
+    auto head = m_head.load(std::memory_order_relaxed);
+    auto count = std::min(m_tail.load(std::memory_order_seq_cst) - head, max);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        events[i] = m_events[(head + i) % EVENT_RING_SIZE];
+    }
+    m_head.store(head + count, std::memory_order_release);
+    return count;
+}
+
+bool EventRing::sleep() noexcept(true)
+{
+    m_sleeping.store(true, std::memory_order_seq_cst);
+    if (m_head.load(std::memory_order_relaxed) != m_tail.load(std::memory_order_seq_cst)) {
+        m_sleeping.store(false, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void EventRing::awake() noexcept(true)
+{
+    m_sleeping.store(false, std::memory_order_relaxed);
+    uint64_t count;
+    if (read(m_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN && errno != EINTR)
+        std::cerr << "ERROR: could not wait for events: " << strerror(errno) << "\n";
+}
+
+void EventRing::wake() noexcept(true)
+{
+    uint64_t one = 1;
+    if (write(m_wakeFd, &one, sizeof(one)) < 0)
+        std::cerr << "ERROR: could not wake up event thread: " << strerror(errno) << "\n";
+}
+
+void EventRing::stop() noexcept(true)
+{
+    m_stopped = true;
+    wake();
+}
+
+bool EventRing::stopped() const noexcept(true)
+{
+    return m_stopped;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "RudeDrawer.h"
+
+#include "ErrorHandling.h"
+
+// EventRing.h - A bounded, lock-free, single-producer/single-consumer queue
+// of events, delivered in FIFO order.
+// The producer is the render thread, the consumer is the `EventChannel` of the
+// window, on a reactor thread. When the queue is empty, the consumer waits for
+// an eventfd to become readable, that the producer only writes to when the
+// consumer is asleep.
+
+// Must be a power of two
+#define EVENT_RING_SIZE 1024
+
+class EventRing {
+private:
+    RudeDrawerEvent m_events[EVENT_RING_SIZE];
+    // Both only ever grow, and wrap around at `UINT32_MAX`
+    alignas(64) std::atomic<uint32_t> m_head = 0;
+    alignas(64) std::atomic<uint32_t> m_tail = 0;
+    std::atomic<bool> m_sleeping = false;
+    std::atomic<bool> m_stopped = false;
+    int m_wakeFd = -1;
+
+public:
+    ~EventRing() noexcept(true);
+
+    Result<void*, void*> open() noexcept(true);
+    // Readable when the consumer has to wake up, non-blocking.
+    int wakeFd() const noexcept(true);
+
+    // Producer only. Returns false when the ring is full, the event is dropped.
+    bool push(RudeDrawerEvent event) noexcept(true);
+    // Producer only. The index the next event will be pushed at.
+    uint32_t tail() const noexcept(true);
+    // Whether the consumer popped every event before `index`.
+    bool consumed(uint32_t index) const noexcept(true);
+    // Consumer only. Pops up to `max` events into `events`, and returns how many.
+    uint32_t pop(RudeDrawerEvent* events, uint32_t max) noexcept(true);
+    // Consumer only. Goes to sleep until `wakeFd()` becomes readable, unless the
+    // ring is not empty anymore, in which case it returns false and stays awake.
+    bool sleep() noexcept(true);
+    // Consumer only. Called once `wakeFd()` became readable, makes it unreadable.
+    void awake() noexcept(true);
+    // Wakes up the consumer, from any thread.
+    void wake() noexcept(true);
+    // Tells the consumer that nothing will be pushed anymore, from any thread.
+    void stop() noexcept(true);
+    bool stopped() const noexcept(true);
+};
@@ -0,0 +1,81 @@
+#include "FrameStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "RudeDrawer.h"
+
+FrameStats::FrameStats() noexcept(false)
+{
+    for (auto& samples : m_samples) {
+        samples.resize(STATS_WINDOW_FRAMES);
+    }
+}
+
+FrameStats::Clock::time_point FrameStats::now() noexcept(true)
+{
+    return Clock::now();
+}
+
+FrameStats::Clock::time_point FrameStats::lap(RudeDrawerPhase phase, Clock::time_point since) noexcept(true)
+{
+    auto time = Clock::now();
+    m_current[phase] += time - since;
+    return time;
+}
+
+void FrameStats::beginFrame() noexcept(true)
+{
+    auto time = Clock::now();
+    if (m_started) {
+        m_current[RDPHASE_FRAME] = time - m_frameStart;
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+        for (auto phase = 0; phase < RDPHASE_COUNT; ++phase) {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(m_current[phase]).count();
+            m_samples[phase][m_next] = (uint32_t)std::min<int64_t>(us, UINT32_MAX);
+            m_current[phase] = Clock::duration::zero();
+        }
+        m_next = (m_next + 1) % STATS_WINDOW_FRAMES;
+        m_frames = std::min(m_frames + 1, (uint32_t)STATS_WINDOW_FRAMES);
+    }
+
+    m_frameStart = time;
+    m_started = true;
+}
+
+void FrameStats::countCoalescedEvent() noexcept(true)
+{
+    m_coalescedEvents.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameStats::snapshot(RudeDrawerStats& stats) noexcept(true)
+{
+    std::vector<uint32_t> samples;
+
+    stats.coalescedEvents = m_coalescedEvents.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    stats.frames = m_frames;
+    for (auto phase = 0; phase < RDPHASE_COUNT; ++phase) {
+        if (m_frames == 0) {
+            stats.phases[phase] = RudeDrawerPhaseStats { };
+            continue;
+        }
+
+        // Until the window is full, the samples only fill its start
+        samples.assign(m_samples[phase].begin(), m_samples[phase].begin() + m_frames);
+
+        auto percentile = [&](int p) {
+            auto nth = samples.begin() + (samples.size() - 1) * p / 100;
+            std::nth_element(samples.begin(), nth, samples.end());
+            return *nth;
+        };
+        stats.phases[phase].p50 = percentile(50);
+        stats.phases[phase].p99 = percentile(99);
+        stats.phases[phase].max = *std::max_element(samples.begin(), samples.end());
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "RudeDrawer.h"
+
+// FrameStats.h - Times the phases (`RudeDrawerPhase`) of the frames of the
+// render loop, and reports their percentiles over the most recent frames.
+// Recording a phase only reads the clock, the percentiles are only worked
+// out when they are asked for.
+
+// Number of frames the percentiles are taken from
+#define STATS_WINDOW_FRAMES 600
+
+class FrameStats {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    // Time spent in every phase of the frame being rendered
+    Clock::duration m_current[RDPHASE_COUNT] = { };
+    Clock::time_point m_frameStart;
+    bool m_started = false;
+
+    // Guards the samples, that the render thread writes once per frame
+    // while client threads read them.
+    std::mutex m_mutex;
+    // The last `STATS_WINDOW_FRAMES` samples of every phase, in microseconds
+    std::vector<uint32_t> m_samples[RDPHASE_COUNT];
+    uint32_t m_next = 0;
+    uint32_t m_frames = 0;
+
+    std::atomic<uint64_t> m_coalescedEvents = 0;
+
+public:
+    FrameStats() noexcept(false);
+
+    static Clock::time_point now() noexcept(true);
+
+    // Adds the time since `since` to `phase` of the current frame, and returns
+    // the current time, so that consecutive phases can be chained.
+    Clock::time_point lap(RudeDrawerPhase phase, Clock::time_point since) noexcept(true);
+    // Records the frame started by the previous call, if any, and starts a new one.
+    // Only called by the render thread.
+    void beginFrame() noexcept(true);
+    // Counts an event merged into a pending one of the same kind.
+    void countCoalescedEvent() noexcept(true);
+
+    void snapshot(RudeDrawerStats& stats) noexcept(true);
+};
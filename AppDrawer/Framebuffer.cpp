@@ -0,0 +1,111 @@
+#include "Framebuffer.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "RudeDrawer.h"
+
+#include "ErrorHandling.h"
+
+Result<void*, Framebuffer*> Framebuffer::create(int width, int height, std::string shmName)
+{
+    Framebuffer* fb = new Framebuffer();
+
+    fb->m_width = width;
+    fb->m_height = height;
+    fb->m_size = width * height * COMPONENTS;
+    fb->m_shmName = shmName;
+    fb->m_shmFd = -1;
+
+    if (shmName.empty()) {
+        fb->m_pixels = new uint8_t[fb->m_size];
+        std::memset(fb->m_pixels, 0, fb->m_size);
+        return Result<void*, Framebuffer*>::fromValue(fb);
+    }
+
+    fb->m_shmFd = shm_open(shmName.c_str(), O_CREAT | O_RDWR, 0666);
+    if (fb->m_shmFd == -1) {
+        std::cerr << "ERROR: could not create shared memory `" << shmName
+                  << "` for framebuffer: " << strerror(errno) << "\n";
+        return Result<void*, Framebuffer*>::fromError(nullptr);
+    }
+
+    if (ftruncate(fb->m_shmFd, fb->m_size) == -1) {
+        std::cerr << "ERROR: could not truncate shared memory `" << shmName
+                  << "` for framebuffer: " << strerror(errno) << "\n";
+        return Result<void*, Framebuffer*>::fromError(nullptr);
+    }
+
+    fb->m_pixels = (uint8_t*)mmap(nullptr, fb->m_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fb->m_shmFd, 0);
+    if (fb->m_pixels == MAP_FAILED) {
+        std::cerr << "ERROR: could not mmap shared memory `" << shmName
+                  << "` for framebuffer: " << strerror(errno) << "\n";
+        return Result<void*, Framebuffer*>::fromError(nullptr);
+    }
+
+    return Result<void*, Framebuffer*>::fromValue(fb);
+}
+
+Result<void*, void*> Framebuffer::dump(std::string const& path)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: could not open `" << path << "` to dump the framebuffer: "
+                  << strerror(errno) << "\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    file << "P7\n"
+         << "WIDTH " << m_width << "\n"
+         << "HEIGHT " << m_height << "\n"
+         << "DEPTH " << COMPONENTS << "\n"
+         << "MAXVAL 255\n"
+         << "TUPLTYPE RGB_ALPHA\n"
+         << "ENDHDR\n";
+    file.write((char const*)m_pixels, m_size);
+
+    if (!file) {
+        std::cerr << "ERROR: could not write framebuffer to `" << path << "`\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    return Result<void*, void*>::fromValue(nullptr);
+}
+
+Result<void*, void*> Framebuffer::destroy()
+{
+    if (m_shmName.empty()) {
+        delete[] m_pixels;
+        return Result<void*, void*>::fromValue(nullptr);
+    }
+
+    if (munmap(m_pixels, m_size) == -1) {
+        std::cerr << "ERROR: could not munmap shared memory `" << m_shmName
+                  << "` for framebuffer: " << strerror(errno) << "\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    if (close(m_shmFd) == -1) {
+        std::cerr << "ERROR: could not close shared memory `" << m_shmName
+                  << "` for framebuffer: " << strerror(errno) << "\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    if (shm_unlink(m_shmName.c_str()) == -1) {
+        std::cerr << "ERROR: could not unlink shared memory `" << m_shmName
+                  << "` for framebuffer: " << strerror(errno) << "\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    return Result<void*, void*>::fromValue(nullptr);
+}
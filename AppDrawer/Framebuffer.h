@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "ErrorHandling.h"
+
+// Framebuffer.h - An RGBA framebuffer in memory, used by the software backend.
+
+class Framebuffer {
+public:
+    // RGBA data, `m_width * m_height * COMPONENTS` bytes, rows are not padded.
+    uint8_t* m_pixels;
+    int m_width;
+    int m_height;
+    int m_size;
+
+    // Set when the framebuffer lives in a POSIX shared memory that other
+    // processes can map.
+    std::string m_shmName;
+    int m_shmFd;
+
+    // An empty `shmName` allocates the framebuffer in private memory.
+    static Result<void*, Framebuffer*> create(int width, int height, std::string shmName);
+
+    // Writes the framebuffer to `path` as a PAM (`P7`, `RGB_ALPHA`) image.
+    Result<void*, void*> dump(std::string const& path);
+    Result<void*, void*> destroy();
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+#include "RudeDrawer.h"
+
+// InputSampler.h - Turns the state of the keyboard into key presses and
+// releases, once per frame, without asking about every key.
+// Presses are read from a queue of pressed keys (raylib's `GetKeyPressed()`),
+// and only the keys that are held down are checked for release. The keyboard
+// is passed in as functions, so that the sampler does not depend on raylib.
+
+// Key codes are below this, see `RudeDrawerKey`
+#define KEY_CODE_MAX 512
+
+struct KeyTransition {
+    RudeDrawerKey key;
+    // Pressed, or released
+    bool pressed;
+};
+
+// Whether `code` is a `RudeDrawerKey`, from a table built at compile time.
+bool isKnownKey(int code) noexcept(true);
+
+class InputSampler {
+private:
+    std::bitset<KEY_CODE_MAX> m_down;
+    // The keys set in `m_down`, so that releases are found without scanning it
+    std::vector<RudeDrawerKey> m_downKeys;
+
+    void release(int index, std::vector<KeyTransition>& transitions) noexcept(true);
+
+public:
+    // Appends the transitions since the previous call to `transitions`, releases
+    // first. `nextPressed()` returns the next key pressed since then, or 0 once
+    // there are none left, and `isDown(key)` whether a key is down now.
+    template<typename P, typename D>
+    void sample(P&& nextPressed, D&& isDown, std::vector<KeyTransition>& transitions) noexcept(true);
+};
+
+template<typename P, typename D>
+void InputSampler::sample(P&& nextPressed, D&& isDown, std::vector<KeyTransition>& transitions) noexcept(true)
+{
+    for (auto i = (int)m_downKeys.size(); i-- > 0;) {
+        if (!isDown(m_downKeys[i]))
+            release(i, transitions);
+    }
+
+    for (int code; (code = nextPressed()) != 0;) {
+        if (!isKnownKey(code))
+            continue;
+
+        // Pressed again within a frame, it was released in between
+        if (m_down[code]) {
+            for (auto i = 0; i < (int)m_downKeys.size(); ++i) {
+                if (m_downKeys[i] == code) {
+                    release(i, transitions);
+                    break;
+                }
+            }
+        }
+
+        m_down[code] = true;
+        m_downKeys.push_back((RudeDrawerKey)code);
+        transitions.push_back(KeyTransition { (RudeDrawerKey)code, true });
+    }
+}
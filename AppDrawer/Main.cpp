@@ -1,209 +1,311 @@
-#include <ranges>
+#include <chrono>
+#include <csignal>
+#include <iostream>
 #include <raylib.h>
 #include <raymath.h>
 #include <string.h>
+#include <string>
+#include <string_view>
 #include <sys/signal.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 #include "AppDrawer.h"
+#include "Benchmark.h"
+#include "Decoration.h"
+#include "FrameStats.h"
+#include "Framebuffer.h"
+#include "InputSampler.h"
+#include "Occlusion.h"
 #include "RudeDrawer.h"
+#include "SoftwareCompositor.h"
+
+#define SCREEN_WIDTH 640
+#define SCREEN_HEIGHT 480
+// Frame rate of the headless backend, as there is no vsync to wait for
+#define HEADLESS_FPS 60
+
+enum Backend {
+    // Composites on the GPU through raylib.
+    BACKEND_RAYLIB,
+    // Composites on the CPU into a `Framebuffer`.
+    BACKEND_SOFTWARE,
+};
+
+struct Options {
+    Backend backend = BACKEND_RAYLIB;
+    // Runs without a display and without input (software backend only)
+    bool headless = false;
+    int width = SCREEN_WIDTH;
+    int height = SCREEN_HEIGHT;
+    // Where to dump the framebuffer on exit (software backend only)
+    std::string dumpPath;
+    // POSIX shared memory exposing the framebuffer (software backend only)
+    std::string shmName;
+    // Number of frames to render before exiting, -1 renders until closed
+    long frames = -1;
+    // Threads compositing the framebuffer (software backend only), 0 uses all of them
+    int threads = 0;
+    // Threads handling the clients
+    int ioThreads = 1;
+    // Runs the compositor self-checks and benchmarks, then exits
+    bool benchmark = false;
+};
+
+// The state of the input devices, that input events carry. Sampled once per frame.
+struct InputState {
+    Vector2 mousePos;
+    // A combination of `RudeDrawerModifier`
+    uint32_t modifiers;
+    // When raylib polled the input, see `Window::timestamp()`
+    uint64_t timestamp;
+    // Keys pressed and released since the previous frame
+    std::vector<KeyTransition> keys;
+};
+
+static volatile sig_atomic_t quitRequested = 0;
+
+void usage(char const* program) noexcept(true)
+{
+    std::cerr << "Usage: " << program << " [OPTIONS]\n"
+              << "Options:\n"
+              << "    --backend=<raylib|software>  How windows are composited (default: raylib)\n"
+              << "    --headless                   Run without a display (requires `--backend=software`)\n"
+              << "    --size=<W>x<H>               Size of the screen (default: "
+              << SCREEN_WIDTH << "x" << SCREEN_HEIGHT << ")\n"
+              << "    --dump=<path>                Dump the framebuffer as a PAM image on exit\n"
+              << "    --shm=<name>                 Expose the framebuffer as the POSIX shared memory `name`\n"
+              << "    --frames=<n>                 Exit after rendering `n` frames\n"
+              << "    --threads=<n>                Composite on `n` threads (default: one per hardware thread)\n"
+              << "    --io-threads=<n>             Handle clients on `n` threads (default: 1)\n"
+              << "    --benchmark                  Run the compositor self-checks and benchmarks, then exit\n"
+              << "    --help                       Print this message\n";
+}
+
+bool parseOptions(int argc, char** argv, Options& options) noexcept(true)
+{
+    for (auto i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        auto value = arg.substr(arg.find('=') + 1);
+
+        if (arg == "--backend=raylib") {
+            options.backend = BACKEND_RAYLIB;
+        } else if (arg == "--backend=software") {
+            options.backend = BACKEND_SOFTWARE;
+        } else if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg.starts_with("--size=")) {
+            if (sscanf(std::string(value).c_str(), "%dx%d", &options.width, &options.height) != 2
+                || options.width <= 0 || options.height <= 0) {
+                std::cerr << "ERROR: invalid size `" << value << "`\n";
+                return false;
+            }
+        } else if (arg.starts_with("--dump=")) {
+            options.dumpPath = value;
+        } else if (arg.starts_with("--shm=")) {
+            options.shmName = value;
+        } else if (arg.starts_with("--frames=")) {
+            if (sscanf(std::string(value).c_str(), "%ld", &options.frames) != 1 || options.frames < 0) {
+                std::cerr << "ERROR: invalid frame count `" << value << "`\n";
+                return false;
+            }
+        } else if (arg.starts_with("--threads=")) {
+            if (sscanf(std::string(value).c_str(), "%d", &options.threads) != 1 || options.threads < 0) {
+                std::cerr << "ERROR: invalid thread count `" << value << "`\n";
+                return false;
+            }
+        } else if (arg.starts_with("--io-threads=")) {
+            if (sscanf(std::string(value).c_str(), "%d", &options.ioThreads) != 1 || options.ioThreads <= 0) {
+                std::cerr << "ERROR: invalid thread count `" << value << "`\n";
+                return false;
+            }
+        } else if (arg == "--benchmark") {
+            options.benchmark = true;
+        } else {
+            if (arg != "--help")
+                std::cerr << "ERROR: unknown option `" << arg << "`\n";
+            return false;
+        }
+    }
 
-#define BORDER_THICKNESS 5
-#define TITLEBAR_THICKNESS 20.0f
+    auto softwareOnly = options.headless || !options.dumpPath.empty() || !options.shmName.empty()
+        || options.threads != 0;
+    if (softwareOnly && options.backend != BACKEND_SOFTWARE) {
+        std::cerr << "ERROR: `--headless`, `--dump`, `--shm` and `--threads` require `--backend=software`\n";
+        return false;
+    }
 
-void closeButton(AppDrawer* appdrawer, Window* window, Rectangle titleBarRect) noexcept(true)
+    return true;
+}
+
+void sampleInput(InputSampler& sampler, uint64_t polledAt, InputState& input) noexcept(true)
 {
-    auto active = window->m_id == appdrawer->topWindow()->m_id;
+    uint32_t modifiers = 0;
+    if (IsKeyDown(RDKEY_LEFT_SHIFT) || IsKeyDown(RDKEY_RIGHT_SHIFT))
+        modifiers |= RDMOD_SHIFT;
+    if (IsKeyDown(RDKEY_LEFT_CONTROL) || IsKeyDown(RDKEY_RIGHT_CONTROL))
+        modifiers |= RDMOD_CONTROL;
+    if (IsKeyDown(RDKEY_LEFT_ALT) || IsKeyDown(RDKEY_RIGHT_ALT))
+        modifiers |= RDMOD_ALT;
+    if (IsKeyDown(RDKEY_LEFT_SUPER) || IsKeyDown(RDKEY_RIGHT_SUPER))
+        modifiers |= RDMOD_SUPER;
+
+    input.mousePos = GetMousePosition();
+    input.modifiers = modifiers;
+    input.timestamp = polledAt;
+
+    input.keys.clear();
+    sampler.sample(GetKeyPressed, IsKeyDown, input.keys);
+}
 
-    Rectangle closeButtonRect = {
-        .x = titleBarRect.x,
-        .y = titleBarRect.y,
-        .width = TITLEBAR_THICKNESS,
-        .height = TITLEBAR_THICKNESS,
+// An event caused by `input`, with the cursor position relative to `window`.
+RudeDrawerEvent inputEvent(Window* window, InputState const& input, RudeDrawerEventKind kind) noexcept(true)
+{
+    auto event = Window::makeEvent(kind);
+    event.mousePos = RudeDrawerVec2D {
+        .x = (int)(input.mousePos.x - window->m_area.x),
+        .y = (int)(input.mousePos.y - window->m_area.y),
     };
-    DrawRectangleRec(closeButtonRect, RED);
+    event.modifiers = input.modifiers;
+    event.timestamp = input.timestamp;
+    return event;
+}
+
+// Handles the decorations of the window under the cursor. `draggedWindow` is the
+// ID of the window dragged by its title bar, 0 if none.
+void decorationInput(AppDrawer* appdrawer, InputState const& input, uint32_t& draggedWindow) noexcept(true)
+{
+    if (appdrawer->windowCount() == 0)
+        return;
+    auto active = appdrawer->topWindow();
 
     // Close button logic
-    if (CheckCollisionPointRec(GetMousePosition(), closeButtonRect)
-        && IsMouseButtonReleased(MOUSE_LEFT_BUTTON)
-        && active) {
-        RudeDrawerEvent event;
-        event.kind = RDEVENT_CLOSE_WIN;
-        window->sendEvent(event);
+    if (CheckCollisionPointRec(GetMousePosition(), closeButtonBounds(active->m_area))
+        && IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) {
+        active->sendEvent(inputEvent(active, input, RDEVENT_CLOSE_WIN));
+    }
+
+    // Title bar logic
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+        auto window = appdrawer->windowAt(GetMousePosition());
+        if (window != nullptr && CheckCollisionPointRec(GetMousePosition(), titleBarBounds(window->m_area))) {
+            draggedWindow = window->m_id;
+        }
+    }
+
+    if (draggedWindow != 0) {
+        // Only once it is active, see `handleFocus()`
+        if (draggedWindow == active->m_id) {
+            appdrawer->moveWindow(active, GetMouseDelta());
+        }
+
+        if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+            draggedWindow = 0;
+        }
     }
 }
 
-void titleBar(AppDrawer* appdrawer, Window* window) noexcept(true)
+void windowDecoration(Window* window) noexcept(true)
 {
-    auto active = window->m_id == appdrawer->topWindow()->m_id;
+    DrawRectangleLinesEx(borderBounds(window->m_area), BORDER_THICKNESS, BLUE);
 
-    Rectangle titleBarRect = {
-        .x = window->m_area.x - BORDER_THICKNESS,
-        .y = window->m_area.y - BORDER_THICKNESS - TITLEBAR_THICKNESS,
-        .width = window->m_area.width + BORDER_THICKNESS * 2,
-        .height = TITLEBAR_THICKNESS,
-    };
+    auto titleBarRect = titleBarBounds(window->m_area);
     DrawRectangleRec(titleBarRect, YELLOW);
-
-    closeButton(appdrawer, window, titleBarRect);
+    DrawRectangleRec(closeButtonBounds(window->m_area), RED);
 
     DrawText(window->m_title.c_str(), window->m_area.x + TITLEBAR_THICKNESS + 1, titleBarRect.y,
         titleBarRect.height, BLUE);
+}
 
-    if (CheckCollisionPointRec(GetMousePosition(), titleBarRect)) {
-        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-            window->m_isDragging = true;
-        }
+void dispatchInput(AppDrawer* appdrawer, InputState const& input) noexcept(true)
+{
+    // Handle key events
+    for (auto i = 0; i < (int)input.keys.size() && appdrawer->windowCount() != 0; ++i) {
+        auto eventKind = input.keys[i].pressed ? RDEVENT_KEYPRESS : RDEVENT_KEYRELEASE;
+        auto event = inputEvent(appdrawer->topWindow(), input, eventKind);
+        event.key = input.keys[i].key;
+        appdrawer->topWindow()->sendEvent(event);
     }
 
-    if (window->m_isDragging) {
-        if (active) {
-            auto delta = GetMouseDelta();
-            window->m_area.x += delta.x;
-            window->m_area.y += delta.y;
+    // Handle mouse events
+    if (appdrawer->windowCount() != 0) {
+        auto mouseEvent = inputEvent(appdrawer->topWindow(), input, RDEVENT_NONE);
+        auto mouseWheelMove = GetMouseWheelMove();
+        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) || IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+            mouseEvent.kind = IsMouseButtonPressed(MOUSE_BUTTON_LEFT) ? RDEVENT_MOUSEPRESS : RDEVENT_MOUSERELEASE;
+            mouseEvent.mouseButton = RDMOUSE_LEFT;
+        } else if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT) || IsMouseButtonReleased(MOUSE_BUTTON_RIGHT)) {
+            mouseEvent.kind = IsMouseButtonPressed(MOUSE_BUTTON_RIGHT) ? RDEVENT_MOUSEPRESS : RDEVENT_MOUSERELEASE;
+            mouseEvent.mouseButton = RDMOUSE_RIGHT;
+        } else if (IsMouseButtonPressed(MOUSE_BUTTON_MIDDLE) || IsMouseButtonReleased(MOUSE_BUTTON_MIDDLE)) {
+            mouseEvent.kind = IsMouseButtonPressed(MOUSE_BUTTON_MIDDLE) ? RDEVENT_MOUSEPRESS : RDEVENT_MOUSERELEASE;
+            mouseEvent.mouseButton = RDMOUSE_MIDDLE;
+        } else if (mouseWheelMove > 0 || mouseWheelMove < 0) {
+            mouseEvent.kind = RDEVENT_MOUSEPRESS;
+            mouseEvent.mouseButton = (mouseWheelMove > 0) ? RDMOUSE_UP : RDMOUSE_DOWN;
         }
 
-        if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
-            window->m_isDragging = false;
+        if (mouseEvent.kind != 0) {
+            appdrawer->topWindow()->sendEvent(mouseEvent);
+        }
+    }
+
+    if (appdrawer->windowCount() != 0) {
+        if (!Vector2Equals(Vector2Zero(), GetMouseDelta())
+            && CheckCollisionPointRec(GetMousePosition(), appdrawer->topWindow()->m_area)) {
+            appdrawer->topWindow()->sendEvent(inputEvent(appdrawer->topWindow(), input, RDEVENT_MOUSEMOVE));
         }
     }
 }
 
-void windowBorders(Window* window) noexcept(true)
+void handleFocus(AppDrawer* appdrawer) noexcept(true)
 {
-    auto border = window->m_area;
-    border.width += BORDER_THICKNESS * 2;
-    border.height += BORDER_THICKNESS * 2;
-    border.x -= BORDER_THICKNESS;
-    border.y -= BORDER_THICKNESS;
-    DrawRectangleLinesEx(border, BORDER_THICKNESS, BLUE);
+    // Handle window focus
+    if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+        appdrawer->lockWindows();
+
+        auto w = appdrawer->windowAt(GetMousePosition());
+        if (w != nullptr && w != appdrawer->topWindow()) {
+            appdrawer->changeActiveWindow(w->m_id);
+        }
+
+        appdrawer->unlockWindows();
+    }
 }
 
-void windowDecoration(AppDrawer* appdrawer, Window* window) noexcept(true)
+bool shouldQuit(Options const& options, long frame) noexcept(true)
 {
-    windowBorders(window);
-    titleBar(appdrawer, window);
+    if (quitRequested)
+        return true;
+    if (options.frames >= 0 && frame >= options.frames)
+        return true;
+    return !options.headless && WindowShouldClose();
 }
 
-int main() noexcept(true)
+int main(int argc, char** argv) noexcept(true)
 {
     signal(SIGPIPE, SIG_IGN);
 
-    RudeDrawerKey allKeys[] = {
-        RDKEY_NULL,
-        // Alphanumeric keys
-        RDKEY_APOSTROPHE,
-        RDKEY_COMMA,
-        RDKEY_MINUS,
-        RDKEY_PERIOD,
-        RDKEY_SLASH,
-        RDKEY_ZERO,
-        RDKEY_ONE,
-        RDKEY_TWO,
-        RDKEY_THREE,
-        RDKEY_FOUR,
-        RDKEY_FIVE,
-        RDKEY_SIX,
-        RDKEY_SEVEN,
-        RDKEY_EIGHT,
-        RDKEY_NINE,
-        RDKEY_SEMICOLON,
-        RDKEY_EQUAL,
-        RDKEY_A,
-        RDKEY_B,
-        RDKEY_C,
-        RDKEY_D,
-        RDKEY_E,
-        RDKEY_F,
-        RDKEY_G,
-        RDKEY_H,
-        RDKEY_I,
-        RDKEY_J,
-        RDKEY_K,
-        RDKEY_L,
-        RDKEY_M,
-        RDKEY_N,
-        RDKEY_O,
-        RDKEY_P,
-        RDKEY_Q,
-        RDKEY_R,
-        RDKEY_S,
-        RDKEY_T,
-        RDKEY_U,
-        RDKEY_V,
-        RDKEY_W,
-        RDKEY_X,
-        RDKEY_Y,
-        RDKEY_Z,
-        RDKEY_LEFT_BRACKET,
-        RDKEY_BACKSLASH,
-        RDKEY_RIGHT_BRACKET,
-        RDKEY_GRAVE,
-        // Function keys
-        RDKEY_SPACE,
-        RDKEY_ESCAPE,
-        RDKEY_ENTER,
-        RDKEY_TAB,
-        RDKEY_BACKSPACE,
-        RDKEY_INSERT,
-        RDKEY_DELETE,
-        RDKEY_RIGHT,
-        RDKEY_LEFT,
-        RDKEY_DOWN,
-        RDKEY_UP,
-        RDKEY_PAGE_UP,
-        RDKEY_PAGE_DOWN,
-        RDKEY_HOME,
-        RDKEY_END,
-        RDKEY_CAPS_LOCK,
-        RDKEY_SCROLL_LOCK,
-        RDKEY_NUM_LOCK,
-        RDKEY_PRINT_SCREEN,
-        RDKEY_PAUSE,
-        RDKEY_F1,
-        RDKEY_F2,
-        RDKEY_F3,
-        RDKEY_F4,
-        RDKEY_F5,
-        RDKEY_F6,
-        RDKEY_F7,
-        RDKEY_F8,
-        RDKEY_F9,
-        RDKEY_F10,
-        RDKEY_F11,
-        RDKEY_F12,
-        RDKEY_LEFT_SHIFT,
-        RDKEY_LEFT_CONTROL,
-        RDKEY_LEFT_ALT,
-        RDKEY_LEFT_SUPER,
-        RDKEY_RIGHT_SHIFT,
-        RDKEY_RIGHT_CONTROL,
-        RDKEY_RIGHT_ALT,
-        RDKEY_RIGHT_SUPER,
-        RDKEY_KB_MENU,
-        // Keypad keys
-        RDKEY_KP_0,
-        RDKEY_KP_1,
-        RDKEY_KP_2,
-        RDKEY_KP_3,
-        RDKEY_KP_4,
-        RDKEY_KP_5,
-        RDKEY_KP_6,
-        RDKEY_KP_7,
-        RDKEY_KP_8,
-        RDKEY_KP_9,
-        RDKEY_KP_DECIMAL,
-        RDKEY_KP_DIVIDE,
-        RDKEY_KP_MULTIPLY,
-        RDKEY_KP_SUBTRACT,
-        RDKEY_KP_ADD,
-        RDKEY_KP_ENTER,
-        RDKEY_KP_EQUAL
-    };
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (options.benchmark) {
+        return runBenchmarks();
+    }
 
     auto ruid = getuid();
     auto rgid = getgid();
 
-    InitWindow(640, 480, "AppDrawer");
+    if (options.headless) {
+        signal(SIGINT, [](int) { quitRequested = 1; });
+        signal(SIGTERM, [](int) { quitRequested = 1; });
+    } else {
+        InitWindow(options.width, options.height, "AppDrawer");
+    }
 
     if (seteuid(ruid) < 0) {
         fprintf(stderr, "WARNING: Could not set Effective UID to the real one: %s\n", strerror(errno));
@@ -213,116 +315,147 @@ int main() noexcept(true)
         fprintf(stderr, "WARNING: Could not set Effective GID to the real one: %s\n", strerror(errno));
     }
 
-    AppDrawer* appdrawer = new AppDrawer();
+    Framebuffer* framebuffer = nullptr;
+    SoftwareCompositor* compositor = nullptr;
+    Texture2D screenTexture = { };
+    if (options.backend == BACKEND_SOFTWARE) {
+        auto res = Framebuffer::create(options.width, options.height, options.shmName);
+        if (!res.isOk()) {
+            return 1;
+        }
+        framebuffer = res.getValue();
+        compositor = new SoftwareCompositor(framebuffer, options.threads);
+        std::cout << "[INFO] Compositing with `" << compositor->kernelsName() << "` kernels on "
+                  << compositor->threadCount() << " thread(s)\n";
+    }
+
+    AppDrawer* appdrawer = new AppDrawer(options.width, options.height, options.ioThreads);
 
     SetTraceLogLevel(LOG_WARNING);
-    while (!WindowShouldClose()) {
-        BeginDrawing();
-        ClearBackground(LIGHTGRAY);
+    auto& stats = appdrawer->stats();
+    auto nextFrame = std::chrono::steady_clock::now();
+    // raylib polls the input at the end of `EndDrawing()`
+    auto inputPolledAt = Window::timestamp();
+    InputSampler sampler;
+    InputState input = { };
+    uint32_t draggedWindow = 0;
+    for (long frame = 0; !shouldQuit(options, frame); ++frame) {
+        stats.beginFrame();
+
+        if (!options.headless)
+            sampleInput(sampler, inputPolledAt, input);
+
+        if (!options.headless) {
+            BeginDrawing();
+            ClearBackground(LIGHTGRAY);
+        }
 
-        Texture2D texture;
-        // Lock mutex before modifying `appdrawer->m_windows`' contents
-        appdrawer->lockWindows();
+        auto time = FrameStats::now();
+        {
+            // The windows published at the start of the frame are drawn without
+            // locking them, and live until it ends even if they are removed
+            EpochGuard pinned(appdrawer->epochs());
+            auto& windows = appdrawer->windows();
+
+            updateVisibility(windows, Rectangle { 0, 0, (float)options.width, (float)options.height });
+            time = stats.lap(RDPHASE_DRAW, time);
+
+            if (!options.headless) {
+                appdrawer->lockWindows();
+                decorationInput(appdrawer, input, draggedWindow);
+                appdrawer->unlockWindows();
+                time = stats.lap(RDPHASE_DECORATION, time);
+            }
 
-        // Draw windows
-        for (auto i = 0; i < appdrawer->windowCount(); ++i) {
-            auto w = appdrawer->windowIndex(i);
-
-            BeginScissorMode(w->m_area.x, w->m_area.y, w->m_area.width, w->m_area.height);
-            Image image = {
-                .data = w->m_pixels,
-                .width = (int)w->m_area.width,
-                .height = (int)w->m_area.height,
-                .mipmaps = 1,
-                .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
-            };
-            texture = LoadTextureFromImage(image);
-            DrawTexture(texture, w->m_area.x, w->m_area.y, WHITE);
-            EndScissorMode();
-
-            windowDecoration(appdrawer, w);
-        }
+            if (options.backend == BACKEND_RAYLIB) {
+                appdrawer->lockWindows();
+                appdrawer->unloadStaleTextures();
+                appdrawer->unlockWindows();
+                time = stats.lap(RDPHASE_UPLOAD, time);
 
-        // Handle key events
-        for (unsigned long i = 0; i < sizeof(allKeys) / sizeof(allKeys[0]) && appdrawer->windowCount() != 0; ++i) {
-            RudeDrawerEventKind eventKind;
-            if (IsKeyPressed(allKeys[i]))
-                eventKind = RDEVENT_KEYPRESS;
-            else if (IsKeyReleased(allKeys[i]))
-                eventKind = RDEVENT_KEYRELEASE;
-            else
-                continue;
-
-            RudeDrawerEvent event;
-            event.kind = eventKind;
-            event.key = allKeys[i];
-            appdrawer->topWindow()->sendEvent(event);
-        }
+                // Draw windows
+                for (auto w : windows) {
+                    if (!w->m_visible)
+                        continue;
 
-        // Handle mouse events
-        if (appdrawer->windowCount() != 0) {
-            RudeDrawerEvent mouseEvent;
-            mouseEvent.kind = (RudeDrawerEventKind)0;
-            auto mouseWheelMove = GetMouseWheelMove();
-            if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) || IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
-                mouseEvent.kind = IsMouseButtonPressed(MOUSE_BUTTON_LEFT) ? RDEVENT_MOUSEPRESS : RDEVENT_MOUSERELEASE;
-                mouseEvent.mouseButton = RDMOUSE_LEFT;
-            } else if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT) || IsMouseButtonReleased(MOUSE_BUTTON_RIGHT)) {
-                mouseEvent.kind = IsMouseButtonPressed(MOUSE_BUTTON_RIGHT) ? RDEVENT_MOUSEPRESS : RDEVENT_MOUSERELEASE;
-                mouseEvent.mouseButton = RDMOUSE_RIGHT;
-            } else if (IsMouseButtonPressed(MOUSE_BUTTON_MIDDLE) || IsMouseButtonReleased(MOUSE_BUTTON_MIDDLE)) {
-                mouseEvent.kind = IsMouseButtonPressed(MOUSE_BUTTON_MIDDLE) ? RDEVENT_MOUSEPRESS : RDEVENT_MOUSERELEASE;
-                mouseEvent.mouseButton = RDMOUSE_MIDDLE;
-            } else if (mouseWheelMove > 0 || mouseWheelMove < 0) {
-                mouseEvent.kind = RDEVENT_MOUSEPRESS;
-                mouseEvent.mouseButton = (mouseWheelMove > 0) ? RDMOUSE_UP : RDMOUSE_DOWN;
-            }
+                    w->uploadTexture();
+                    time = stats.lap(RDPHASE_UPLOAD, time);
 
-            if (mouseEvent.kind != 0) {
-                appdrawer->topWindow()->sendEvent(mouseEvent);
-            }
-        }
+                    BeginScissorMode(w->m_area.x, w->m_area.y, w->m_area.width, w->m_area.height);
+                    DrawTexture(w->m_texture, w->m_area.x, w->m_area.y, WHITE);
+                    EndScissorMode();
+                    time = stats.lap(RDPHASE_DRAW, time);
 
-        if (appdrawer->windowCount() != 0) {
-            if (!Vector2Equals(Vector2Zero(), GetMouseDelta())
-                && CheckCollisionPointRec(GetMousePosition(), appdrawer->topWindow()->m_area)) {
-                RudeDrawerEvent event;
-                event.kind = RDEVENT_MOUSEMOVE;
-                appdrawer->topWindow()->sendEvent(event);
+                    windowDecoration(w);
+                    time = stats.lap(RDPHASE_DECORATION, time);
+                }
+            } else {
+                compositor->compose(windows);
+                time = stats.lap(RDPHASE_DRAW, time);
             }
-        }
 
-        // Unlock mutex after modifying `appdrawer->m_windows`' contents
-        appdrawer->unlockWindows();
+            // Input and events go to the windows as they are now
+            appdrawer->lockWindows();
 
-        // Handle window focus
-        if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && appdrawer->windowCount() != 0) {
-            for (auto i = appdrawer->windowCount() - 1; i-- > 0;) {
-                auto w = appdrawer->windowIndex(i);
-
-                auto windowArea = w->m_area;
-                windowArea.y -= BORDER_THICKNESS + TITLEBAR_THICKNESS;
-                windowArea.x -= BORDER_THICKNESS;
-                windowArea.width += BORDER_THICKNESS * 2;
-                windowArea.height += TITLEBAR_THICKNESS + BORDER_THICKNESS * 2;
-
-                if (CheckCollisionPointRec(GetMousePosition(), windowArea)) {
-                    if (w->m_id != appdrawer->topWindow()->m_id) {
-                        appdrawer->changeActiveWindow(w->m_id);
-                    }
-                    break;
-                }
+            if (!options.headless) {
+                dispatchInput(appdrawer, input);
+                stats.lap(RDPHASE_INPUT, time);
             }
+
+            appdrawer->sendFrameEvents();
+
+            appdrawer->unlockWindows();
+        }
+        appdrawer->reclaimWindows();
+
+        if (options.headless) {
+            nextFrame += std::chrono::microseconds(1000000 / HEADLESS_FPS);
+            std::this_thread::sleep_until(nextFrame);
+            continue;
         }
 
+        time = FrameStats::now();
+        handleFocus(appdrawer);
         appdrawer->setMousePosition(GetMousePosition());
+        time = stats.lap(RDPHASE_FOCUS, time);
+
+        if (options.backend == BACKEND_SOFTWARE) {
+            if (screenTexture.id == 0) {
+                Image image = {
+                    .data = framebuffer->m_pixels,
+                    .width = framebuffer->m_width,
+                    .height = framebuffer->m_height,
+                    .mipmaps = 1,
+                    .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+                };
+                screenTexture = LoadTextureFromImage(image);
+            } else {
+                UpdateTexture(screenTexture, framebuffer->m_pixels);
+            }
+            time = stats.lap(RDPHASE_UPLOAD, time);
+            DrawTexture(screenTexture, 0, 0, WHITE);
+            time = stats.lap(RDPHASE_DRAW, time);
+        }
 
         EndDrawing();
-        UnloadTexture(texture);
+        inputPolledAt = Window::timestamp();
+        stats.lap(RDPHASE_PRESENT, time);
     }
     SetTraceLogLevel(LOG_INFO);
 
-    CloseWindow();
+    if (framebuffer != nullptr) {
+        if (!options.dumpPath.empty()) {
+            if (framebuffer->dump(options.dumpPath).isOk())
+                std::cout << "[INFO] Dumped framebuffer to `" << options.dumpPath << "`\n";
+        }
+        framebuffer->destroy();
+    }
+
+    if (!options.headless) {
+        if (screenTexture.id != 0)
+            UnloadTexture(screenTexture);
+        CloseWindow();
+    }
 
     return 0;
 }
@@ -0,0 +1,79 @@
+#include "Occlusion.h"
+
+#include <algorithm>
+#include <raylib.h>
+#include <vector>
+
+#include "Decoration.h"
+#include "Window.h"
+
+static bool intersect(Rectangle a, Rectangle b, Rectangle& result) noexcept(true)
+{
+    auto x0 = std::max(a.x, b.x);
+    auto y0 = std::max(a.y, b.y);
+    auto x1 = std::min(a.x + a.width, b.x + b.width);
+    auto y1 = std::min(a.y + a.height, b.y + b.height);
+    if (x0 >= x1 || y0 >= y1)
+        return false;
+
+    result = Rectangle { x0, y0, x1 - x0, y1 - y0 };
+    return true;
+}
+
+// Appends the parts of `rect` that are not covered by `hole` to `result`
+static void subtract(Rectangle rect, Rectangle hole, std::vector<Rectangle>& result) noexcept(true)
+{
+    Rectangle overlap;
+    if (!intersect(rect, hole, overlap)) {
+        result.push_back(rect);
+        return;
+    }
+
+    auto rectBottom = rect.y + rect.height;
+    auto overlapBottom = overlap.y + overlap.height;
+
+    // Above and below the hole, with the whole width of `rect`
+    if (overlap.y > rect.y)
+        result.push_back(Rectangle { rect.x, rect.y, rect.width, overlap.y - rect.y });
+    if (overlapBottom < rectBottom)
+        result.push_back(Rectangle { rect.x, overlapBottom, rect.width, rectBottom - overlapBottom });
+
+    // Left and right of the hole, with the height of the hole
+    if (overlap.x > rect.x)
+        result.push_back(Rectangle { rect.x, overlap.y, overlap.x - rect.x, overlap.height });
+    if (overlap.x + overlap.width < rect.x + rect.width)
+        result.push_back(Rectangle { overlap.x + overlap.width, overlap.y,
+            rect.x + rect.width - overlap.x - overlap.width, overlap.height });
+}
+
+void updateVisibility(std::vector<Window*> const& windows, Rectangle screen) noexcept(true)
+{
+    std::vector<Rectangle> covered;
+    std::vector<Rectangle> visible;
+    std::vector<Rectangle> remaining;
+
+    for (auto i = windows.size(); i-- > 0;) {
+        auto w = windows[i];
+
+        Rectangle bounds;
+        if (!intersect(decorationBounds(w->m_area), screen, bounds)) {
+            w->setVisible(false);
+            continue;
+        }
+
+        visible.assign(1, bounds);
+        for (auto& occluder : covered) {
+            remaining.clear();
+            for (auto& rect : visible) {
+                subtract(rect, occluder, remaining);
+            }
+            visible.swap(remaining);
+            if (visible.empty())
+                break;
+        }
+
+        w->setVisible(!visible.empty());
+        if (!visible.empty())
+            covered.push_back(bounds);
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <raylib.h>
+#include <vector>
+
+#include "Window.h"
+
+// Occlusion.h - Works out which windows are entirely covered by the windows
+// above them, so that the render loop can skip them.
+// Windows are treated as opaque rectangles covering their decorated bounds.
+
+// Calls `Window::setVisible()` on every window of `windows`, ordered from
+// bottom to top. Parts of windows outside of `screen` count as hidden.
+void updateVisibility(std::vector<Window*> const& windows, Rectangle screen) noexcept(true);
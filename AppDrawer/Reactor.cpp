@@ -0,0 +1,265 @@
+#include "Reactor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The most ready file descriptors handled per wakeup of a loop
+#define REACTOR_BATCH_MAX 64
+
+// The most file descriptors passed along with one `sendmsg()` (`SCM_MAX_FD`)
+#define PASSED_FDS_MAX 253
+
+static ssize_t sendPassing(int fd, uint8_t const* data, size_t size, int const* fds, size_t fdCount) noexcept(true)
+{
+    iovec iov = { (void*)data, size };
+    union {
+        char buffer[CMSG_SPACE(PASSED_FDS_MAX * sizeof(int))];
+        cmsghdr align;
+    } control;
+
+    msghdr message = { };
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = CMSG_SPACE(fdCount * sizeof(int));
+
+    auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(fdCount * sizeof(int));
+    std::memcpy(CMSG_DATA(header), fds, fdCount * sizeof(int));
+
+    return sendmsg(fd, &message, MSG_NOSIGNAL);
+}
+
+// Returns how many bytes were sent before `fd` would block, or -1 on failure
+static ssize_t sendUntilBlocked(int fd, uint8_t const* data, size_t size, std::vector<int>* passing) noexcept(true)
+{
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t count;
+        if (passing == nullptr || passing->empty()) {
+            count = send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+        } else {
+            // Descriptors need at least a byte to go along with
+            auto fdCount = std::min(passing->size(), (size_t)PASSED_FDS_MAX);
+            auto chunk = fdCount < passing->size() ? 1 : size - sent;
+            count = sendPassing(fd, data + sent, chunk, passing->data(), fdCount);
+            if (count > 0) {
+                for (size_t i = 0; i < fdCount; ++i) {
+                    close((*passing)[i]);
+                }
+                passing->erase(passing->begin(), passing->begin() + fdCount);
+            }
+        }
+
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        sent += count;
+    }
+    return sent;
+}
+
+bool sendNonBlocking(int fd, std::vector<uint8_t>& pending, void const* data, size_t size,
+    std::vector<int>* passing) noexcept(true)
+{
+    auto bytes = (uint8_t const*)data;
+    if (pending.empty()) {
+        auto sent = sendUntilBlocked(fd, bytes, size, passing);
+        if (sent < 0)
+            return false;
+        bytes += sent;
+        size -= sent;
+    }
+    pending.insert(pending.end(), bytes, bytes + size);
+    return true;
+}
+
+bool flushNonBlocking(int fd, std::vector<uint8_t>& pending, std::vector<int>* passing) noexcept(true)
+{
+    auto sent = sendUntilBlocked(fd, pending.data(), pending.size(), passing);
+    if (sent < 0)
+        return false;
+    pending.erase(pending.begin(), pending.begin() + sent);
+    return true;
+}
+
+ReactorHandler::ReactorHandler(int loop) noexcept(true)
+{
+    m_loop = loop;
+}
+
+Reactor::Reactor(int threadCount) noexcept(false)
+{
+    if (threadCount <= 0)
+        threadCount = 1;
+
+    for (auto i = 0; i < threadCount; ++i) {
+        auto loop = std::make_unique<Loop>();
+        loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epollFd == -1) {
+            throw std::runtime_error(std::string("ERROR: could not create epoll instance: ") + strerror(errno));
+        }
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event = { };
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        if (loop->wakeFd == -1 || epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &event) == -1) {
+            throw std::runtime_error(std::string("ERROR: could not create eventfd: ") + strerror(errno));
+        }
+        m_loops.push_back(std::move(loop));
+    }
+
+    for (auto& loop : m_loops) {
+        loop->thread = std::thread(&Reactor::run, this, loop.get());
+        loop->thread.detach();
+    }
+}
+
+int Reactor::threadCount() const noexcept(true)
+{
+    return m_loops.size();
+}
+
+int Reactor::pickLoop() noexcept(true)
+{
+    return m_nextLoop.fetch_add(1, std::memory_order_relaxed) % m_loops.size();
+}
+
+bool Reactor::add(ReactorSource* source, uint32_t events) noexcept(true)
+{
+    epoll_event event = { };
+    event.events = events;
+    event.data.ptr = source;
+    if (epoll_ctl(m_loops[source->handler->m_loop]->epollFd, EPOLL_CTL_ADD, source->fd, &event) == -1) {
+        std::cerr << "ERROR: could not watch file descriptor: " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool Reactor::modify(ReactorSource* source, uint32_t events) noexcept(true)
+{
+    epoll_event event = { };
+    event.events = events;
+    event.data.ptr = source;
+    if (epoll_ctl(m_loops[source->handler->m_loop]->epollFd, EPOLL_CTL_MOD, source->fd, &event) == -1) {
+        std::cerr << "ERROR: could not watch file descriptor: " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+void Reactor::remove(ReactorSource* source) noexcept(true)
+{
+    epoll_ctl(m_loops[source->handler->m_loop]->epollFd, EPOLL_CTL_DEL, source->fd, nullptr);
+}
+
+void Reactor::retire(ReactorHandler* handler) noexcept(true)
+{
+    if (handler->m_retired)
+        return;
+    handler->m_retired = true;
+    m_loops[handler->m_loop]->retired.push_back(handler);
+}
+
+void Reactor::post(Loop* loop, Posted posted) noexcept(false)
+{
+    {
+        std::lock_guard<std::mutex> guard(loop->postedMutex);
+        loop->posted.push_back(std::move(posted));
+    }
+
+    uint64_t one = 1;
+    if (write(loop->wakeFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        std::cerr << "ERROR: could not wake up loop: " << strerror(errno) << "\n";
+    }
+}
+
+void Reactor::post(int loop, std::function<void()> task) noexcept(false)
+{
+    post(m_loops[loop].get(), Posted { nullptr, std::move(task) });
+}
+
+void Reactor::hold(ReactorHandler* handler) noexcept(true)
+{
+    handler->m_holds += 1;
+}
+
+void Reactor::post(ReactorHandler* handler, std::function<void()> task) noexcept(false)
+{
+    post(m_loops[handler->m_loop].get(), Posted { handler, std::move(task) });
+}
+
+void Reactor::runPosted(Loop* loop) noexcept(true)
+{
+    uint64_t count;
+    while (read(loop->wakeFd, &count, sizeof(count)) == -1 && errno == EINTR) { }
+
+    std::vector<Posted> posted;
+    {
+        std::lock_guard<std::mutex> guard(loop->postedMutex);
+        posted.swap(loop->posted);
+    }
+
+    for (auto& p : posted) {
+        if (p.handler == nullptr) {
+            p.task();
+            continue;
+        }
+        p.task();
+        p.handler->m_holds -= 1;
+    }
+}
+
+void Reactor::run(Loop* loop) noexcept(true)
+{
+    epoll_event events[REACTOR_BATCH_MAX];
+    while (true) {
+        auto count = epoll_wait(loop->epollFd, events, REACTOR_BATCH_MAX, -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "ERROR: could not wait for file descriptors: " << strerror(errno) << "\n";
+            break;
+        }
+
+        for (auto i = 0; i < count; ++i) {
+            auto source = (ReactorSource*)events[i].data.ptr;
+            if (source == nullptr) {
+                runPosted(loop);
+                continue;
+            }
+            // Handlers retired earlier in the batch are not deleted yet
+            if (!source->handler->m_retired)
+                source->handler->onReady(source, events[i].events);
+        }
+
+        // Held handlers wait for their tasks, in a later batch
+        std::vector<ReactorHandler*> held;
+        for (auto handler : loop->retired) {
+            if (handler->m_holds > 0)
+                held.push_back(handler);
+            else
+                delete handler;
+        }
+        loop->retired.swap(held);
+    }
+    std::cout << "Exiting `Reactor::run()` thread...\n";
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Reactor.h - A fixed number of threads, each waiting on its own epoll
+// instance for file descriptors to become ready, and calling their handler.
+// Every handler belongs to one loop, and is only ever called by its thread,
+// so handlers need no locking of their own. The number of threads does not
+// depend on how many file descriptors are watched.
+// Other threads hand work back to a loop with `post()`, which wakes it up
+// through an eventfd.
+
+class ReactorHandler;
+
+// Sends as much of `data` as the non-blocking socket `fd` takes, after the bytes
+// already `pending`, and appends the rest to `pending`. Returns false if the
+// connection failed.
+// The file descriptors of `passing` go along with the first bytes sent
+// (`SCM_RIGHTS`), and are closed and removed once they went.
+bool sendNonBlocking(int fd, std::vector<uint8_t>& pending, void const* data, size_t size,
+    std::vector<int>* passing = nullptr) noexcept(true);
+// Sends as much of `pending` as `fd` takes, and removes it. Returns false if the
+// connection failed.
+bool flushNonBlocking(int fd, std::vector<uint8_t>& pending, std::vector<int>* passing = nullptr) noexcept(true);
+
+// A file descriptor watched by a handler. Lives as long as the handler.
+struct ReactorSource {
+    ReactorHandler* handler;
+    int fd = -1;
+};
+
+class ReactorHandler {
+public:
+    // The loop the handler belongs to, see `Reactor::pickLoop()`.
+    int m_loop;
+    // Set by `Reactor::retire()`, the handler is not called anymore.
+    bool m_retired = false;
+    // Tasks that will be posted to the handler, see `Reactor::hold()`.
+    uint32_t m_holds = 0;
+
+    ReactorHandler(int loop) noexcept(true);
+    virtual ~ReactorHandler() = default;
+
+    // Called by the thread of `m_loop` when `source` is ready, with the
+    // `EPOLL*` flags of what it is ready for.
+    virtual void onReady(ReactorSource* source, uint32_t events) noexcept(true) = 0;
+};
+
+class Reactor {
+private:
+    struct Posted {
+        // nullptr for tasks posted to the loop itself
+        ReactorHandler* handler;
+        std::function<void()> task;
+    };
+
+    struct Loop {
+        int epollFd;
+        // Readable once tasks were posted, watched with a null source
+        int wakeFd;
+        std::thread thread;
+        // Handlers retired during the current batch of events, deleted after it
+        // unless they are held.
+        std::vector<ReactorHandler*> retired;
+        std::mutex postedMutex;
+        std::vector<Posted> posted;
+    };
+
+    std::vector<std::unique_ptr<Loop>> m_loops;
+    std::atomic<uint32_t> m_nextLoop = 0;
+
+    void run(Loop* loop) noexcept(true);
+    void runPosted(Loop* loop) noexcept(true);
+    void post(Loop* loop, Posted posted) noexcept(false);
+
+public:
+    // Zero threads is one thread.
+    Reactor(int threadCount) noexcept(false);
+
+    int threadCount() const noexcept(true);
+    // The loop new handlers should belong to, round-robin.
+    int pickLoop() noexcept(true);
+
+    // Starts watching `source->fd` for `events` (`EPOLL*` flags). Can be called
+    // from any thread.
+    bool add(ReactorSource* source, uint32_t events) noexcept(true);
+    bool modify(ReactorSource* source, uint32_t events) noexcept(true);
+    void remove(ReactorSource* source) noexcept(true);
+    // Stops calling `handler`, and deletes it once the current batch of events
+    // has been handled. Only called by the thread of the handler's loop.
+    void retire(ReactorHandler* handler) noexcept(true);
+
+    // Calls `task` on the thread of `loop`. Can be called from any thread.
+    void post(int loop, std::function<void()> task) noexcept(false);
+    // Keeps `handler` from being deleted until a task is posted to it. Only
+    // called by the thread of the handler's loop.
+    void hold(ReactorHandler* handler) noexcept(true);
+    // Calls `task` on the thread of the loop of `handler`, which is kept until then
+    // even if it was retired, and releases a `hold()`. Can be called from any thread.
+    void post(ReactorHandler* handler, std::function<void()> task) noexcept(false);
+};
@@ -0,0 +1,157 @@
+#include "SoftwareCompositor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <raylib.h>
+#include <vector>
+
+#include "Blend.h"
+#include "Decoration.h"
+#include "Framebuffer.h"
+#include "RudeDrawer.h"
+#include "Window.h"
+
+static PixelSpan clipSpan(PixelSpan clip, Rectangle rect) noexcept(true)
+{
+    return PixelSpan {
+        .x0 = std::max((int)std::floor(rect.x), clip.x0),
+        .y0 = std::max((int)std::floor(rect.y), clip.y0),
+        .x1 = std::min((int)std::floor(rect.x + rect.width), clip.x1),
+        .y1 = std::min((int)std::floor(rect.y + rect.height), clip.y1),
+    };
+}
+
+static uint32_t packColor(Color color) noexcept(true)
+{
+    uint8_t bytes[COMPONENTS] = { color.r, color.g, color.b, color.a };
+    uint32_t packed;
+    std::memcpy(&packed, bytes, COMPONENTS);
+    return packed;
+}
+
+SoftwareCompositor::SoftwareCompositor(Framebuffer* framebuffer, int threadCount) noexcept(false)
+    : m_pool(threadCount)
+{
+    m_framebuffer = framebuffer;
+    m_kernels = &blendKernels();
+
+    m_tilesX = (framebuffer->m_width + COMPOSITOR_TILE_SIZE - 1) / COMPOSITOR_TILE_SIZE;
+    m_tilesY = (framebuffer->m_height + COMPOSITOR_TILE_SIZE - 1) / COMPOSITOR_TILE_SIZE;
+    m_tileWindows.resize(m_tilesX * m_tilesY);
+}
+
+char const* SoftwareCompositor::kernelsName() const noexcept(true)
+{
+    return m_kernels->name;
+}
+
+int SoftwareCompositor::threadCount() const noexcept(true)
+{
+    return m_pool.threadCount();
+}
+
+void SoftwareCompositor::fillRect(PixelSpan clip, Rectangle rect, Color color) noexcept(true)
+{
+    auto span = clipSpan(clip, rect);
+    if (span.empty())
+        return;
+
+    auto packed = packColor(color);
+    for (auto y = span.y0; y < span.y1; ++y) {
+        auto row = m_framebuffer->m_pixels + (y * m_framebuffer->m_width + span.x0) * COMPONENTS;
+        m_kernels->fill(row, packed, span.x1 - span.x0);
+    }
+}
+
+void SoftwareCompositor::strokeRect(PixelSpan clip, Rectangle rect, int thickness, Color color) noexcept(true)
+{
+    fillRect(clip, Rectangle { rect.x, rect.y, rect.width, (float)thickness }, color);
+    fillRect(clip, Rectangle { rect.x, rect.y + rect.height - thickness, rect.width, (float)thickness }, color);
+    fillRect(clip, Rectangle { rect.x, rect.y + thickness, (float)thickness, rect.height - thickness * 2 }, color);
+    fillRect(clip,
+        Rectangle { rect.x + rect.width - thickness, rect.y + thickness,
+            (float)thickness, rect.height - thickness * 2 },
+        color);
+}
+
+void SoftwareCompositor::blitWindow(PixelSpan clip, Window* window) noexcept(true)
+{
+    auto span = clipSpan(clip, window->m_area);
+    if (span.empty())
+        return;
+
+    auto originX = (int)std::floor(window->m_area.x);
+    auto originY = (int)std::floor(window->m_area.y);
+    auto windowWidth = (int)window->m_area.width;
+
+    for (auto y = span.y0; y < span.y1; ++y) {
+        auto dst = m_framebuffer->m_pixels + (y * m_framebuffer->m_width + span.x0) * COMPONENTS;
+        auto src = window->m_frontPixels + ((y - originY) * windowWidth + (span.x0 - originX)) * COMPONENTS;
+        m_kernels->blend(dst, src, span.x1 - span.x0);
+    }
+}
+
+void SoftwareCompositor::drawDecoration(PixelSpan clip, Window* window) noexcept(true)
+{
+    strokeRect(clip, borderBounds(window->m_area), BORDER_THICKNESS, BLUE);
+    fillRect(clip, titleBarBounds(window->m_area), YELLOW);
+    fillRect(clip, closeButtonBounds(window->m_area), RED);
+    // NOTE: Titles are not rendered, the software backend has no font rasterizer
+}
+
+void SoftwareCompositor::composeTile(int tile) noexcept(true)
+{
+    auto tileX = (tile % m_tilesX) * COMPOSITOR_TILE_SIZE;
+    auto tileY = (tile / m_tilesX) * COMPOSITOR_TILE_SIZE;
+    PixelSpan clip = {
+        .x0 = tileX,
+        .y0 = tileY,
+        .x1 = std::min(tileX + COMPOSITOR_TILE_SIZE, m_framebuffer->m_width),
+        .y1 = std::min(tileY + COMPOSITOR_TILE_SIZE, m_framebuffer->m_height),
+    };
+
+    fillRect(clip, Rectangle { (float)clip.x0, (float)clip.y0,
+                       (float)(clip.x1 - clip.x0), (float)(clip.y1 - clip.y0) },
+        LIGHTGRAY);
+
+    for (auto w : m_tileWindows[tile]) {
+        blitWindow(clip, w);
+        drawDecoration(clip, w);
+    }
+}
+
+void SoftwareCompositor::compose(std::vector<Window*> const& windows) noexcept(true)
+{
+    for (auto& tileWindows : m_tileWindows) {
+        tileWindows.clear();
+    }
+
+    // Bin windows into the tiles they touch, keeping them in z-order
+    PixelSpan screen = { 0, 0, m_framebuffer->m_width, m_framebuffer->m_height };
+    m_readWindows.clear();
+    for (auto w : windows) {
+        if (!w->m_visible)
+            continue;
+
+        auto span = clipSpan(screen, decorationBounds(w->m_area));
+        if (span.empty())
+            continue;
+
+        w->beginRead();
+        m_readWindows.push_back(w);
+
+        for (auto ty = span.y0 / COMPOSITOR_TILE_SIZE; ty <= (span.y1 - 1) / COMPOSITOR_TILE_SIZE; ++ty) {
+            for (auto tx = span.x0 / COMPOSITOR_TILE_SIZE; tx <= (span.x1 - 1) / COMPOSITOR_TILE_SIZE; ++tx) {
+                m_tileWindows[ty * m_tilesX + tx].push_back(w);
+            }
+        }
+    }
+
+    m_pool.parallelFor(m_tilesX * m_tilesY, [this](int tile) { composeTile(tile); });
+
+    for (auto w : m_readWindows) {
+        w->endRead();
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <raylib.h>
+#include <vector>
+
+#include "Blend.h"
+#include "Framebuffer.h"
+#include "ThreadPool.h"
+#include "Window.h"
+
+// SoftwareCompositor.h - Composites windows and their decorations into a
+// `Framebuffer` on the CPU, without any GPU or display.
+// The framebuffer is split into tiles of `COMPOSITOR_TILE_SIZE` pixels, that
+// are composited in parallel, each one only with the windows that touch it.
+
+#define COMPOSITOR_TILE_SIZE 128
+
+// A rectangle in framebuffer pixels. `x1` and `y1` are exclusive.
+struct PixelSpan {
+    int x0, y0, x1, y1;
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+};
+
+class SoftwareCompositor {
+private:
+    Framebuffer* m_framebuffer;
+    BlendKernels const* m_kernels;
+    ThreadPool m_pool;
+
+    int m_tilesX;
+    int m_tilesY;
+    // The windows touching every tile, from bottom to top.
+    std::vector<std::vector<Window*>> m_tileWindows;
+    // The windows whose front buffer is latched during `compose()`.
+    std::vector<Window*> m_readWindows;
+
+    void fillRect(PixelSpan clip, Rectangle rect, Color color) noexcept(true);
+    void strokeRect(PixelSpan clip, Rectangle rect, int thickness, Color color) noexcept(true);
+    void blitWindow(PixelSpan clip, Window* window) noexcept(true);
+    void drawDecoration(PixelSpan clip, Window* window) noexcept(true);
+    void composeTile(int tile) noexcept(true);
+
+public:
+    // `threadCount` includes the calling thread, zero uses every hardware thread.
+    SoftwareCompositor(Framebuffer* framebuffer, int threadCount) noexcept(false);
+
+    int threadCount() const noexcept(true);
+    char const* kernelsName() const noexcept(true);
+
+    // Composites `windows`, ordered from bottom to top. Windows that are not
+    // `m_visible` are skipped.
+    // They must be read within an epoch of `AppDrawer::epochs()`, see `AppDrawer::windows()`.
+    void compose(std::vector<Window*> const& windows) noexcept(true);
+};
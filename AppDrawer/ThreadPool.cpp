@@ -0,0 +1,130 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+ThreadPool::ThreadPool(int threadCount) noexcept(false)
+{
+    if (threadCount <= 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (auto i = 0; i < threadCount; ++i) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+
+    // The last queue belongs to the thread calling `parallelFor()`
+    for (auto i = 0; i < threadCount - 1; ++i) {
+        m_threads.emplace_back(&ThreadPool::worker, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() noexcept(true)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_quit = true;
+    }
+    m_wakeup.notify_all();
+
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+int ThreadPool::threadCount() const noexcept(true)
+{
+    return m_queues.size();
+}
+
+bool ThreadPool::popOrSteal(int self, int& task) noexcept(true)
+{
+    {
+        auto& own = *m_queues[self];
+        std::lock_guard<std::mutex> guard(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    auto count = (int)m_queues.size();
+    for (auto i = 1; i < count; ++i) {
+        auto& victim = *m_queues[(self + i) % count];
+        std::lock_guard<std::mutex> guard(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::work(int self) noexcept(true)
+{
+    int task;
+    while (popOrSteal(self, task)) {
+        (*m_task)(task);
+        if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::worker(int self) noexcept(true)
+{
+    uint64_t seenBatch = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [&] { return m_quit || m_batch != seenBatch; });
+            if (m_quit)
+                return;
+            seenBatch = m_batch;
+        }
+
+        work(self);
+    }
+}
+
+void ThreadPool::parallelFor(int count, std::function<void(int)> const& task) noexcept(true)
+{
+    if (count <= 0)
+        return;
+
+    auto self = (int)m_queues.size() - 1;
+    if (self == 0 || count == 1) {
+        for (auto i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    m_task = &task;
+    m_remaining.store(count, std::memory_order_relaxed);
+
+    // Contiguous chunks keep neighbouring tasks on the same thread
+    auto queueCount = (int)m_queues.size();
+    for (auto q = 0; q < queueCount; ++q) {
+        auto& queue = *m_queues[q];
+        std::lock_guard<std::mutex> guard(queue.mutex);
+        for (auto i = q * count / queueCount; i < (q + 1) * count / queueCount; ++i) {
+            queue.tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_batch += 1;
+    }
+    m_wakeup.notify_all();
+
+    work(self);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&] { return m_remaining.load(std::memory_order_acquire) == 0; });
+}
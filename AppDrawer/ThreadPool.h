@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool.h - A work-stealing thread pool for data-parallel loops.
+// Every participant (the workers and the calling thread) owns a queue of
+// task indices. It pops from the front of its own queue, and once that is
+// empty, steals from the back of the others' queues.
+
+class ThreadPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    std::vector<std::thread> m_threads;
+    std::vector<std::unique_ptr<Queue>> m_queues;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_done;
+    uint64_t m_batch = 0;
+    bool m_quit = false;
+
+    std::function<void(int)> const* m_task = nullptr;
+    std::atomic<int> m_remaining = 0;
+
+    bool popOrSteal(int self, int& task) noexcept(true);
+    void work(int self) noexcept(true);
+    void worker(int self) noexcept(true);
+
+public:
+    // `threadCount` includes the calling thread. Zero uses one thread per
+    // hardware thread.
+    ThreadPool(int threadCount) noexcept(false);
+    ~ThreadPool() noexcept(true);
+
+    int threadCount() const noexcept(true);
+
+    // Calls `task(i)` for every `i` in [0, count) and returns once they all
+    // finished. The calling thread takes part in the work.
+    void parallelFor(int count, std::function<void(int)> const& task) noexcept(true);
+};
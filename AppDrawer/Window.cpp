@@ -1,5 +1,6 @@
 #include "Window.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstddef>
 #include <cstdint>
@@ -8,38 +9,73 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <time.h>
 
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "EventQueue.h"
 #include "RudeDrawer.h"
 
 #include "ErrorHandling.h"
 
-Result<void*, Window*> Window::create(std::string title, uint32_t width, uint32_t height, uint32_t id)
+// Creates an anonymous shared memory of `size` bytes, to be passed to the client
+// by file descriptor. Its size is sealed, so that the client cannot make the server
+// fault by shrinking it. Returns -1 on failure, with `errno` set.
+static int createSealedMemory(std::string const& name, size_t size) noexcept(true)
 {
+    auto fd = memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+        return -1;
+
+    if (ftruncate(fd, size) == -1
+        || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+        auto error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+Result<void*, Window*> Window::create(std::string title, uint32_t width, uint32_t height, uint32_t id,
+    uint32_t bufferCount)
+{
+    size_t size;
+    auto invalid = width == 0 || height == 0 || width > WINDOW_DIMENSION_MAX || height > WINDOW_DIMENSION_MAX
+        || bufferCount == 0 || bufferCount > WINDOW_BUFFERS_MAX;
+    if (invalid || __builtin_mul_overflow((size_t)width * height, (size_t)COMPONENTS * bufferCount, &size)) {
+        std::cerr << "ERROR: invalid window of " << width << "x" << height << " with "
+                  << bufferCount << " buffers\n";
+        return Result<void*, Window*>::fromError(nullptr);
+    }
+
     Window* w = new Window();
 
     w->m_title = title;
     w->m_area.width = width;
     w->m_area.height = height;
-    w->m_area.x = (float)GetScreenWidth() / 2 - (float)width / 2;
-    w->m_area.y = (float)GetScreenHeight() / 2 - (float)height / 2;
+    w->m_area.x = 0;
+    w->m_area.y = 0;
     w->m_id = id;
+    w->m_texture = Texture2D { };
+    w->m_reportsDamage = false;
+    w->m_forceFullUpload = false;
+    w->m_visible = true;
+    w->m_paintPending = false;
+    w->m_alwaysUpdating = false;
+    w->m_bufferCount = bufferCount;
+    w->m_frontBuffer = 0;
+    w->m_backBuffer = bufferCount > 1 ? 1 : 0;
 
-    w->m_pixelsShmSize = width * height * COMPONENTS;
-    w->m_pixelsShmName = "/APDWindow" + std::to_string(id);
-    w->m_pixelsShmFd = shm_open(w->m_pixelsShmName.c_str(), O_CREAT | O_RDWR, 0666);
+    w->m_pixelsShmSize = size;
+    w->m_pixelsShmName = "APDWindow" + std::to_string(id);
+    w->m_pixelsShmFd = createSealedMemory(w->m_pixelsShmName, w->m_pixelsShmSize);
     if (w->m_pixelsShmFd == -1) {
         std::cerr << "ERROR: could not create shared memory for window of ID `"
                   << id << "`: " << strerror(errno) << "\n";
-        return Result<void*, Window*>::fromError(nullptr);
-    }
-
-    if (ftruncate(w->m_pixelsShmFd, w->m_pixelsShmSize) == -1) {
-        std::cerr << "ERROR: could not truncate shared memory for window of ID `"
-                  << id << "`: " << strerror(errno) << "\n";
+        delete w;
         return Result<void*, Window*>::fromError(nullptr);
     }
 
@@ -48,6 +84,8 @@ Result<void*, Window*> Window::create(std::string title, uint32_t width, uint32_
     if (w->m_pixels == MAP_FAILED) {
         std::cerr << "ERROR: could not mmap shared memory for window of ID `"
                   << id << "`: " << strerror(errno) << "\n";
+        close(w->m_pixelsShmFd);
+        delete w;
         return Result<void*, Window*>::fromError(nullptr);
     }
 
@@ -56,42 +94,393 @@ Result<void*, Window*> Window::create(std::string title, uint32_t width, uint32_
     return Result<void*, Window*>::fromValue(w);
 }
 
+RudeDrawerEvent Window::makeEvent(RudeDrawerEventKind kind) noexcept(true)
+{
+    RudeDrawerEvent event;
+    std::memset(&event, 0, sizeof(RudeDrawerEvent));
+    event.kind = kind;
+    event.timestamp = timestamp();
+    return event;
+}
+
+uint64_t Window::timestamp() noexcept(true)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
 #define DEBUG_NONLOGGED_EVENTS false
 
 void Window::sendEvent(RudeDrawerEvent event) noexcept(true)
 {
-    if ((event.kind != RDEVENT_PAINT && event.kind != RDEVENT_MOUSEMOVE)
-        || DEBUG_NONLOGGED_EVENTS)
+    auto coalescible = event.kind == RDEVENT_PAINT || event.kind == RDEVENT_MOUSEMOVE
+        || event.kind == RDEVENT_FRAME;
+    auto logged = !coalescible;
+    if (logged || DEBUG_NONLOGGED_EVENTS)
         std::cout << "[INFO] Sending event of ID `" << event.kind
                   << "` to window of ID `" << m_id << "`\n";
-    if (m_events.isPolling) {
-        m_events.events.push_back(event);
-    } else {
-        if ((event.kind != RDEVENT_PAINT && event.kind != RDEVENT_MOUSEMOVE)
-            || DEBUG_NONLOGGED_EVENTS)
+    if (!polling()) {
+        if (logged || DEBUG_NONLOGGED_EVENTS)
             std::cout << "[WARN] Window not polling events, not sending...\n";
+        return;
+    }
+
+    // Only the latest of these matters. While the client has not read the events
+    // of previous frames, they are held back and replace the held one of the same
+    // kind, so that slow clients do not fall further and further behind.
+    if (coalescible && !caughtUp()) {
+        for (auto& held : m_events.held) {
+            if (held.kind == event.kind) {
+                held = event;
+                if (m_stats != nullptr)
+                    m_stats->countCoalescedEvent();
+                return;
+            }
+        }
+        m_events.held.push_back(event);
+        return;
+    }
+
+    // Held events were sent first
+    pushHeldEvents();
+    pushEvent(event);
+}
+
+void Window::flushEvents() noexcept(true)
+{
+    if (!polling()) {
+        m_events.held.clear();
+        return;
+    }
+
+    if (caughtUp())
+        pushHeldEvents();
+    m_events.frameStart = eventsTail();
+}
+
+bool Window::polling() noexcept(true)
+{
+    if (!m_events.isPolling)
+        return false;
+    // The channel stops the ring when the client hangs up
+    return m_events.toQueue || !m_events.ring->stopped();
+}
+
+void Window::pushEvent(RudeDrawerEvent event) noexcept(true)
+{
+    auto pushed = m_events.toQueue ? eventQueuePush(m_events.queue, event) : m_events.ring->push(event);
+    if (!pushed)
+        std::cerr << "[WARN] Event queue of window of ID `" << m_id << "` is full, dropping event...\n";
+}
+
+void Window::pushHeldEvents() noexcept(true)
+{
+    if (polling()) {
+        for (auto& held : m_events.held) {
+            pushEvent(held);
+        }
+    }
+    m_events.held.clear();
+}
+
+uint32_t Window::eventsTail() noexcept(true)
+{
+    return m_events.toQueue ? eventQueueTail(m_events.queue) : m_events.ring->tail();
+}
+
+bool Window::caughtUp() noexcept(true)
+{
+    if (m_events.toQueue)
+        return eventQueueConsumed(m_events.queue, m_events.frameStart);
+    return m_events.ring->consumed(m_events.frameStart);
+}
+
+void Window::startPolling(std::shared_ptr<EventRing> ring) noexcept(true)
+{
+    stopPolling();
+
+    m_events.ring = ring;
+    m_events.toQueue = ring == nullptr;
+    if (m_events.toQueue)
+        __atomic_store_n(&m_events.queue->closed, 0, __ATOMIC_SEQ_CST);
+    m_events.frameStart = eventsTail();
+    m_events.isPolling = true;
+}
+
+void Window::stopPolling() noexcept(true)
+{
+    m_events.isPolling = false;
+    m_events.held.clear();
+
+    if (m_events.queue != nullptr)
+        eventQueueClose(m_events.queue);
+    if (m_events.ring != nullptr)
+        m_events.ring->stop();
+    m_events.ring = nullptr;
+}
+
+Result<void*, void*> Window::openEventQueue() noexcept(true)
+{
+    if (m_events.queue != nullptr)
+        return Result<void*, void*>::fromValue(nullptr);
+
+    m_events.queueShmName = "APDWindowEvents" + std::to_string(m_id);
+    m_events.queueShmFd = createSealedMemory(m_events.queueShmName, sizeof(RudeDrawerEventQueue));
+    if (m_events.queueShmFd == -1) {
+        std::cerr << "ERROR: could not create event queue for window of ID `"
+                  << m_id << "`: " << strerror(errno) << "\n";
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    auto queue = mmap(nullptr, sizeof(RudeDrawerEventQueue), PROT_READ | PROT_WRITE,
+        MAP_SHARED, m_events.queueShmFd, 0);
+    if (queue == MAP_FAILED) {
+        std::cerr << "ERROR: could not mmap event queue for window of ID `"
+                  << m_id << "`: " << strerror(errno) << "\n";
+        // The next try creates it again
+        close(m_events.queueShmFd);
+        m_events.queueShmFd = -1;
+        return Result<void*, void*>::fromError(nullptr);
+    }
+
+    // A zeroed queue is empty
+    std::memset(queue, 0, sizeof(RudeDrawerEventQueue));
+    m_events.queue = (RudeDrawerEventQueue*)queue;
+    return Result<void*, void*>::fromValue(nullptr);
+}
+
+void Window::requestPaint() noexcept(true)
+{
+    m_paintPending = true;
+}
+
+void Window::deliverPaint() noexcept(true)
+{
+    if (!m_visible || !m_paintPending.exchange(false))
+        return;
+
+    sendEvent(makeEvent(RDEVENT_PAINT));
+}
+
+void Window::setVisible(bool visible) noexcept(true)
+{
+    auto exposed = visible && !m_visible;
+    m_visible = visible;
+
+    if (exposed)
+        m_forceFullUpload = true;
+}
+
+// Past this many pending rectangles, damage collapses into their bounding box.
+#define DAMAGE_PENDING_MAX 64
+
+void Window::addDamage(RudeDrawerRect const* rects, uint32_t count) noexcept(true)
+{
+    std::lock_guard<std::mutex> guard(m_damageMutex);
+    m_reportsDamage = true;
+
+    auto& damage = m_bufferCount > 1 ? m_backDamage : m_damage;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        auto& rect = rects[i];
+        if (rect.width <= 0 || rect.height <= 0)
+            continue;
+
+        // In 64 bits, as the ends of rectangles sent by clients can overflow
+        auto x0 = std::max((int64_t)rect.x, (int64_t)0);
+        auto y0 = std::max((int64_t)rect.y, (int64_t)0);
+        auto x1 = std::min((int64_t)rect.x + rect.width, (int64_t)m_area.width);
+        auto y1 = std::min((int64_t)rect.y + rect.height, (int64_t)m_area.height);
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+        damage.push_back(RudeDrawerRect { (int)x0, (int)y0, (int)(x1 - x0), (int)(y1 - y0) });
+    }
+
+    if (damage.size() > DAMAGE_PENDING_MAX) {
+        auto bounds = damage[0];
+        for (auto& rect : damage) {
+            auto x1 = std::max(bounds.x + bounds.width, rect.x + rect.width);
+            auto y1 = std::max(bounds.y + bounds.height, rect.y + rect.height);
+            bounds.x = std::min(bounds.x, rect.x);
+            bounds.y = std::min(bounds.y, rect.y);
+            bounds.width = x1 - bounds.x;
+            bounds.height = y1 - bounds.y;
+        }
+        damage.clear();
+        damage.push_back(bounds);
+    }
+}
+
+CommitResult Window::commit(uint32_t& next, std::function<void(uint32_t)> released) noexcept(false)
+{
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+
+    // With two buffers, the only one to hand out can still be being uploaded
+    auto busy = m_bufferCount == 2 && m_readBuffer == (int)((m_backBuffer + 1) % 2);
+    if (busy && (released == nullptr || m_released != nullptr))
+        return COMMIT_BUSY;
+
+    {
+        std::lock_guard<std::mutex> guard(m_damageMutex);
+        m_damage.insert(m_damage.end(), m_backDamage.begin(), m_backDamage.end());
+        m_backDamage.clear();
+        m_committed = true;
+    }
+
+    if (m_bufferCount == 1) {
+        next = 0;
+        return COMMIT_DONE;
+    }
+
+    m_frontBuffer = m_backBuffer;
+
+    // Hand out the least recently shown buffer that is not being read
+    for (uint32_t i = 1; i < m_bufferCount; ++i) {
+        auto candidate = (m_frontBuffer + i) % m_bufferCount;
+        if ((int)candidate != m_readBuffer) {
+            m_backBuffer = candidate;
+            next = m_backBuffer;
+            return COMMIT_DONE;
+        }
+    }
+
+    // The client cannot commit again before it gets it, see `endRead()`
+    m_backBuffer = (m_frontBuffer + 1) % m_bufferCount;
+    m_released = std::move(released);
+    return COMMIT_PENDING;
+}
+
+uint8_t* Window::latchFrontBuffer() noexcept(true)
+{
+    m_readBuffer = m_frontBuffer;
+    m_frontPixels = m_pixels + (size_t)m_frontBuffer * (size_t)(m_area.width * m_area.height) * COMPONENTS;
+    return m_frontPixels;
+}
+
+uint8_t* Window::beginRead() noexcept(true)
+{
+    std::lock_guard<std::mutex> guard(m_bufferMutex);
+    return latchFrontBuffer();
+}
+
+void Window::endRead() noexcept(true)
+{
+    std::function<void(uint32_t)> released;
+    uint32_t next;
+    {
+        std::lock_guard<std::mutex> guard(m_bufferMutex);
+        m_readBuffer = -1;
+        released.swap(m_released);
+        next = m_backBuffer;
+    }
+    if (released != nullptr)
+        released(next);
+}
+
+void Window::uploadTexture() noexcept(true)
+{
+    uint8_t* pixels;
+    bool reportsDamage;
+    bool committed;
+    {
+        std::lock_guard<std::mutex> bufferGuard(m_bufferMutex);
+        std::lock_guard<std::mutex> damageGuard(m_damageMutex);
+        pixels = latchFrontBuffer();
+        reportsDamage = m_reportsDamage;
+        committed = m_committed;
+        m_committed = false;
+        m_uploadDamage.clear();
+        m_uploadDamage.swap(m_damage);
+    }
+
+    // Buffered windows only change when they commit
+    auto unchanged = m_bufferCount > 1 && !committed && !m_forceFullUpload;
+    if (m_texture.id == 0 || !unchanged)
+        uploadPixels(pixels, reportsDamage);
+
+    endRead();
+}
+
+void Window::uploadPixels(uint8_t* pixels, bool reportsDamage) noexcept(true)
+{
+    if (m_texture.id == 0) {
+        Image image = {
+            .data = pixels,
+            .width = (int)m_area.width,
+            .height = (int)m_area.height,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+        };
+        m_texture = LoadTextureFromImage(image);
+        return;
+    }
+
+    if (!reportsDamage || m_forceFullUpload) {
+        UpdateTexture(m_texture, pixels);
+        m_forceFullUpload = false;
+        return;
+    }
+
+    // Every rect can cover the whole window, their sum does not fit in an int
+    int64_t damagedArea = 0;
+    for (auto& rect : m_uploadDamage) {
+        damagedArea += (int64_t)rect.width * rect.height;
+    }
+    if (damagedArea >= (int64_t)m_area.width * (int64_t)m_area.height) {
+        UpdateTexture(m_texture, pixels);
+        return;
+    }
+
+    auto stride = (int)m_area.width * COMPONENTS;
+    for (auto& rect : m_uploadDamage) {
+        Rectangle rec = {
+            .x = (float)rect.x,
+            .y = (float)rect.y,
+            .width = (float)rect.width,
+            .height = (float)rect.height,
+        };
+
+        // Full-width rows are already contiguous in the shared memory
+        if (rect.width == (int)m_area.width) {
+            UpdateTextureRec(m_texture, rec, pixels + rect.y * stride);
+            continue;
+        }
+
+        auto rowSize = rect.width * COMPONENTS;
+        m_uploadStaging.resize(rowSize * rect.height);
+        for (auto y = 0; y < rect.height; ++y) {
+            std::memcpy(m_uploadStaging.data() + y * rowSize,
+                pixels + (rect.y + y) * stride + rect.x * COMPONENTS, rowSize);
+        }
+        UpdateTextureRec(m_texture, rec, m_uploadStaging.data());
     }
 }
 
 Result<void*, void*> Window::destroy() noexcept(false)
 {
+    stopPolling();
+
+    // Not read anymore, a pending commit gets its buffer
+    endRead();
+
+    if (m_events.queue != nullptr) {
+        munmap(m_events.queue, sizeof(RudeDrawerEventQueue));
+        close(m_events.queueShmFd);
+    }
+
     if (munmap(m_pixels, m_pixelsShmSize) == -1) {
         std::cerr << "ERROR: could not munmap shared memory for window of ID `"
                   << m_id << "`: " << strerror(errno) << "\n";
         return Result<void*, void*>::fromError(nullptr);
     }
 
+    // Clients keep their own descriptors, the memory is freed once they close them
     if (close(m_pixelsShmFd) == -1) {
         std::cerr << "ERROR: could not close shared memory for window of ID `"
                   << m_id << "`: " << strerror(errno) << "\n";
         return Result<void*, void*>::fromError(nullptr);
     }
 
-    if (shm_unlink(m_pixelsShmName.c_str()) == -1) {
-        std::cerr << "ERROR: could not unlink shared memory for window of ID `"
-                  << m_id << "`: " << strerror(errno) << "\n";
-        return Result<void*, void*>::fromError(nullptr);
-    }
-
     return Result<void*, void*>::fromValue(nullptr);
 }
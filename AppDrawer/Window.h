@@ -1,37 +1,154 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include <raylib.h>
 
+#include "EventRing.h"
+#include "FrameStats.h"
 #include "RudeDrawer.h"
 
 #include "ErrorHandling.h"
 
+enum CommitResult {
+    // The next buffer was handed out right away.
+    COMMIT_DONE,
+    // The next buffer is still being read, it is handed out once it is not.
+    COMMIT_PENDING,
+    // The next buffer is still being read, and the commit could not wait.
+    COMMIT_BUSY,
+};
+
 struct WindowEvents {
-    bool isPolling;
-    bool running = true;
-    std::vector<RudeDrawerEvent> events;
+    std::atomic<bool> isPolling = false;
+    // Filled by the render thread, drained by the `EventChannel` of the client.
+    // Every time polling starts it is replaced, as the channel that drained the
+    // previous one can outlive it, and the window.
+    std::shared_ptr<EventRing> ring;
+
+    // The queue shared with the client, when it polls events through shared
+    // memory (`toQueue`), instead of `ring`. Created by `openEventQueue()`, it
+    // lives as long as the window.
+    std::atomic<bool> toQueue = false;
+    RudeDrawerEventQueue* queue = nullptr;
+    std::string queueShmName;
+    int queueShmFd = -1;
+
+    // Mouse moves, paints and frames held back while the client is behind, at
+    // most one of every kind, see `Window::sendEvent()`. Render thread only.
+    std::vector<RudeDrawerEvent> held;
+    // Where the events of the current frame start.
+    uint32_t frameStart = 0;
 };
 
 class Window {
+private:
+    // Whether events are sent, and the client is still there to read them.
+    bool polling() noexcept(true);
+    void pushEvent(RudeDrawerEvent event) noexcept(true);
+    void pushHeldEvents() noexcept(true);
+    uint32_t eventsTail() noexcept(true);
+    // Whether the client read every event sent before the current frame.
+    bool caughtUp() noexcept(true);
+    uint8_t* latchFrontBuffer() noexcept(true);
+    void uploadPixels(uint8_t* pixels, bool reportsDamage) noexcept(true);
+
 public:
     std::string m_title;
 
+    // All the buffers of the window, back to back.
     uint8_t* m_pixels;
     std::string m_pixelsShmName;
     int m_pixelsShmFd;
-    int m_pixelsShmSize;
+    size_t m_pixelsShmSize;
+
+    // The client draws into `m_backBuffer` while the server shows `m_frontBuffer`,
+    // until `commit()` swaps them. `m_readBuffer` is being read by the render
+    // thread (-1 if none), and is never handed back to the client.
+    std::mutex m_bufferMutex;
+    // Called with the back buffer by the render thread once it is done reading
+    // it, for a commit that could not hand it out, see `commit()`.
+    std::function<void(uint32_t)> m_released;
+    uint32_t m_bufferCount = 1;
+    uint32_t m_frontBuffer = 0;
+    uint32_t m_backBuffer = 0;
+    int m_readBuffer = -1;
+    // Whether a buffer was committed since the last upload.
+    bool m_committed = false;
+    // The front buffer latched by `beginRead()`, valid until `endRead()`.
+    uint8_t* m_frontPixels = nullptr;
+
+    // Lives as long as the window. Created lazily by `uploadTexture()`, as
+    // only the render thread owns the OpenGL context.
+    Texture2D m_texture;
+
+    // Regions reported by `RDCMD_DAMAGE_WIN` that still have to be uploaded.
+    std::mutex m_damageMutex;
+    bool m_reportsDamage;
+    std::vector<RudeDrawerRect> m_damage;
+    // Damage of the back buffer, that is only uploaded once committed.
+    std::vector<RudeDrawerRect> m_backDamage;
+    std::vector<RudeDrawerRect> m_uploadDamage;
+    std::vector<uint8_t> m_uploadStaging;
+    // Set when the texture missed updates, and has to be uploaded as a whole.
+    bool m_forceFullUpload;
+
+    // Whether any part of the window can be seen, see `Occlusion.h`.
+    std::atomic<bool> m_visible;
+    // Set by `requestPaint()`, `RDEVENT_PAINT` is sent by `deliverPaint()`.
+    std::atomic<bool> m_paintPending;
 
     uint32_t m_id;
     Rectangle m_area;
     WindowEvents m_events;
-    bool m_isDragging;
+    // Higher is above, set by `WindowTable`.
+    uint64_t m_stacking = 0;
+    // Whether the window receives `RDEVENT_FRAME` after every frame.
+    bool m_alwaysUpdating;
+    // Counts coalesced events, if set.
+    FrameStats* m_stats = nullptr;
+
+    // An event with every field zeroed, timestamped now.
+    static RudeDrawerEvent makeEvent(RudeDrawerEventKind kind) noexcept(true);
+    // Microseconds of `CLOCK_MONOTONIC`, as in `RudeDrawerEvent::timestamp`.
+    static uint64_t timestamp() noexcept(true);
 
-    static Result<void*, Window*> create(std::string title, uint32_t width, uint32_t height, uint32_t id);
+    static Result<void*, Window*> create(std::string title, uint32_t width, uint32_t height, uint32_t id,
+        uint32_t bufferCount);
 
+    // Only called by the render thread, which is the only producer of events.
     void sendEvent(RudeDrawerEvent event) noexcept(true);
+    // Sends the held events if the client caught up, and starts the events of
+    // the next frame. Called by the render thread after every frame.
+    void flushEvents() noexcept(true);
+    // Starts sending events to `ring`, or to the shared event queue if it is
+    // null. The windows must be locked.
+    void startPolling(std::shared_ptr<EventRing> ring) noexcept(true);
+    // Stops sending events, waking the reader up. The windows must be locked.
+    void stopPolling() noexcept(true);
+    // Creates the event queue shared with the client, if it does not exist yet.
+    Result<void*, void*> openEventQueue() noexcept(true);
+    // Asks for a `RDEVENT_PAINT`, from any thread.
+    void requestPaint() noexcept(true);
+    // Sends the requested `RDEVENT_PAINT`, unless the window is hidden, in which
+    // case it is held until the window is exposed again. Render thread only.
+    void deliverPaint() noexcept(true);
+    void setVisible(bool visible) noexcept(true);
+    void addDamage(RudeDrawerRect const* rects, uint32_t count) noexcept(true);
+    // Shows the back buffer and sets `next` to the one the client should draw into.
+    // With two buffers, that one can still be being read. The commit then never
+    // waits: `released` is called with it by the render thread once it is not,
+    // or the commit does nothing if there is no `released`, or one is pending.
+    CommitResult commit(uint32_t& next, std::function<void(uint32_t)> released) noexcept(false);
+    // Latches the front buffer into `m_frontPixels` for the render thread.
+    uint8_t* beginRead() noexcept(true);
+    void endRead() noexcept(true);
+    void uploadTexture() noexcept(true);
     Result<void*, void*> destroy();
 };
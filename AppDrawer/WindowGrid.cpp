@@ -0,0 +1,101 @@
+#include "WindowGrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <raylib.h>
+#include <vector>
+
+#include "Decoration.h"
+#include "Window.h"
+
+WindowGrid::WindowGrid(int screenWidth, int screenHeight) noexcept(false)
+{
+    m_columns = std::max((screenWidth + WINDOW_GRID_CELL_SIZE - 1) / WINDOW_GRID_CELL_SIZE, 1);
+    m_rows = std::max((screenHeight + WINDOW_GRID_CELL_SIZE - 1) / WINDOW_GRID_CELL_SIZE, 1);
+    m_cells.resize(m_columns * m_rows);
+}
+
+WindowGrid::CellRange WindowGrid::cellsOf(Rectangle bounds) const noexcept(true)
+{
+    // Clamped as floats first, windows can be dragged arbitrarily far away
+    auto column = [&](float x) {
+        return (int)std::clamp(std::floor(x / WINDOW_GRID_CELL_SIZE), 0.0f, (float)(m_columns - 1));
+    };
+    auto row = [&](float y) {
+        return (int)std::clamp(std::floor(y / WINDOW_GRID_CELL_SIZE), 0.0f, (float)(m_rows - 1));
+    };
+    return CellRange {
+        column(bounds.x),
+        row(bounds.y),
+        column(bounds.x + bounds.width),
+        row(bounds.y + bounds.height),
+    };
+}
+
+std::vector<Window*>& WindowGrid::cell(int x, int y) noexcept(true)
+{
+    return m_cells[y * m_columns + x];
+}
+
+std::vector<Window*> const& WindowGrid::cell(int x, int y) const noexcept(true)
+{
+    return m_cells[y * m_columns + x];
+}
+
+void WindowGrid::insert(Window* window) noexcept(false)
+{
+    auto range = cellsOf(decorationBounds(window->m_area));
+    for (auto y = range.y0; y <= range.y1; ++y) {
+        for (auto x = range.x0; x <= range.x1; ++x) {
+            cell(x, y).push_back(window);
+        }
+    }
+    m_ranges[window] = range;
+}
+
+void WindowGrid::remove(Window* window) noexcept(true)
+{
+    auto it = m_ranges.find(window);
+    if (it == m_ranges.end())
+        return;
+
+    auto range = it->second;
+    for (auto y = range.y0; y <= range.y1; ++y) {
+        for (auto x = range.x0; x <= range.x1; ++x) {
+            auto& windows = cell(x, y);
+            auto found = std::find(windows.begin(), windows.end(), window);
+            *found = windows.back();
+            windows.pop_back();
+        }
+    }
+    m_ranges.erase(it);
+}
+
+void WindowGrid::update(Window* window) noexcept(false)
+{
+    auto it = m_ranges.find(window);
+    if (it != m_ranges.end()) {
+        // Most moves stay within the same cells
+        auto range = cellsOf(decorationBounds(window->m_area));
+        auto& previous = it->second;
+        if (range.x0 == previous.x0 && range.y0 == previous.y0
+            && range.x1 == previous.x1 && range.y1 == previous.y1)
+            return;
+    }
+
+    remove(window);
+    insert(window);
+}
+
+Window* WindowGrid::topmostAt(Vector2 point) const noexcept(true)
+{
+    auto range = cellsOf(Rectangle { point.x, point.y, 0, 0 });
+
+    Window* topmost = nullptr;
+    for (auto w : cell(range.x0, range.y0)) {
+        if ((topmost == nullptr || w->m_stacking > topmost->m_stacking)
+            && CheckCollisionPointRec(point, decorationBounds(w->m_area)))
+            topmost = w;
+    }
+    return topmost;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <raylib.h>
+#include <unordered_map>
+#include <vector>
+
+#include "Window.h"
+
+// WindowGrid.h - A uniform grid over the screen, that finds the window under a
+// point without looking at every window.
+// Every cell lists the windows whose decorated bounds overlap it. Bounds past the
+// edges of the screen are clamped to the cells along them, so that queries stay
+// exact anywhere. Windows are stacked by `Window::m_stacking`.
+
+// Side of the cells, in pixels
+#define WINDOW_GRID_CELL_SIZE 128
+
+class WindowGrid {
+private:
+    // Cells from `x0`, `y0` to `x1`, `y1` included
+    struct CellRange {
+        int x0;
+        int y0;
+        int x1;
+        int y1;
+    };
+
+    int m_columns;
+    int m_rows;
+    std::vector<std::vector<Window*>> m_cells;
+    std::unordered_map<Window*, CellRange> m_ranges;
+
+    CellRange cellsOf(Rectangle bounds) const noexcept(true);
+    std::vector<Window*>& cell(int x, int y) noexcept(true);
+    std::vector<Window*> const& cell(int x, int y) const noexcept(true);
+
+public:
+    WindowGrid(int screenWidth, int screenHeight) noexcept(false);
+
+    void insert(Window* window) noexcept(false);
+    void remove(Window* window) noexcept(true);
+    // Has to be called after `Window::m_area` changed.
+    void update(Window* window) noexcept(false);
+
+    // The topmost window whose decorations contain `point`, nullptr if none.
+    Window* topmostAt(Vector2 point) const noexcept(true);
+};
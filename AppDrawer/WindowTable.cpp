@@ -0,0 +1,123 @@
+#include "WindowTable.h"
+
+#include <iterator>
+
+WindowTable::WindowTable() noexcept(false)
+{
+    m_snapshot = new std::vector<Window*>();
+}
+
+WindowTable::~WindowTable() noexcept(true)
+{
+    delete m_snapshot.load();
+}
+
+void WindowTable::insert(Window* window) noexcept(false)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    uint32_t index;
+    if (m_freeSlots.empty()) {
+        index = m_slots.size();
+        m_slots.emplace_back();
+    } else {
+        index = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+
+    auto& slot = m_slots[index];
+    slot.window = window;
+    slot.order = m_order.insert(m_order.end(), index);
+    window->m_stacking = ++m_stacking;
+    m_orderChanged = true;
+    m_ids[window->m_id] = index;
+}
+
+Window* WindowTable::remove(uint32_t id) noexcept(true)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto it = m_ids.find(id);
+    if (it == m_ids.end())
+        return nullptr;
+
+    auto index = it->second;
+    auto& slot = m_slots[index];
+    auto window = slot.window;
+    m_order.erase(slot.order);
+    m_orderChanged = true;
+
+    slot.window = nullptr;
+    m_freeSlots.push_back(index);
+    m_ids.erase(it);
+    return window;
+}
+
+bool WindowTable::raise(uint32_t id) noexcept(true)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto it = m_ids.find(id);
+    if (it == m_ids.end())
+        return false;
+
+    auto& slot = m_slots[it->second];
+    slot.window->m_stacking = ++m_stacking;
+    if (std::next(slot.order) != m_order.end()) {
+        m_order.splice(m_order.end(), m_order, slot.order);
+        m_orderChanged = true;
+    }
+    return true;
+}
+
+Window* WindowTable::find(uint32_t id) const noexcept(true)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto it = m_ids.find(id);
+    if (it == m_ids.end())
+        return nullptr;
+    return m_slots[it->second].window;
+}
+
+Window* WindowTable::top() const noexcept(true)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_order.empty())
+        return nullptr;
+    return m_slots[m_order.back()].window;
+}
+
+size_t WindowTable::size() const noexcept(true)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    return m_order.size();
+}
+
+void WindowTable::publish(Epochs& epochs) noexcept(false)
+{
+    std::vector<Window*> const* previous;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        if (!m_orderChanged)
+            return;
+        auto snapshot = new std::vector<Window*>();
+        snapshot->reserve(m_order.size());
+        for (auto index : m_order) {
+            snapshot->push_back(m_slots[index].window);
+        }
+        m_orderChanged = false;
+
+        // Readers that loaded the previous one keep reading it
+        previous = m_snapshot.exchange(snapshot);
+    }
+    epochs.retire([previous] { delete previous; });
+}
+
+std::vector<Window*> const& WindowTable::snapshot() const noexcept(true)
+{
+    return *m_snapshot.load();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Epochs.h"
+#include "Window.h"
+
+// WindowTable.h - The windows of AppDrawer, found by ID in constant time and
+// stacked from bottom to top.
+// Windows live in slots that are reused once they are removed. Raising and
+// removing a window only relinks its slot in the z order. The windows
+// from bottom to top are copied from it into an immutable snapshot when the
+// changes are published, which threads read without locking while it is
+// replaced, and which is reclaimed through `Epochs` once none of them can see it.
+// Windows on top also get the highest `Window::m_stacking`, to compare them.
+
+class WindowTable {
+private:
+    struct Slot {
+        // nullptr while the slot is free
+        Window* window = nullptr;
+        // The position of the window in `m_order`
+        std::list<uint32_t>::iterator order;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+    // The slots of the windows by ID
+    std::unordered_map<uint32_t, uint32_t> m_ids;
+    // Slots of the windows, from bottom to top
+    std::list<uint32_t> m_order;
+    // The windows of `m_order` when it was last published, see `snapshot()`
+    std::atomic<std::vector<Window*> const*> m_snapshot;
+    bool m_orderChanged = false;
+    uint64_t m_stacking = 0;
+    // Lookups can happen without the windows locked, while commands change the table
+    mutable std::mutex m_mutex;
+
+public:
+    WindowTable() noexcept(false);
+    ~WindowTable() noexcept(true);
+
+    // Puts `window` on top.
+    void insert(Window* window) noexcept(false);
+    // Returns the window of ID `id` that was taken out of the table, nullptr if
+    // there is none.
+    Window* remove(uint32_t id) noexcept(true);
+    // Returns false if there is no window of ID `id`.
+    bool raise(uint32_t id) noexcept(true);
+
+    // nullptr if there is no window of ID `id`.
+    Window* find(uint32_t id) const noexcept(true);
+
+    // nullptr if there are no windows.
+    Window* top() const noexcept(true);
+    size_t size() const noexcept(true);
+    // Replaces the snapshot if the order changed since it was taken, and retires
+    // the previous one to `epochs`.
+    void publish(Epochs& epochs) noexcept(false);
+    // The windows from bottom to top when they were last published. Valid as
+    // long as the caller reads within an epoch of the `Epochs` they are published to.
+    std::vector<Window*> const& snapshot() const noexcept(true);
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+// EventQueue.h - Operations on a `RudeDrawerEventQueue` (defined and documented in `RudeDrawer.h`),
+// shared by the server, that pushes events, and LibDraw, that pops them.
+
+#include <climits>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "RudeDrawer.h"
+
+inline void eventQueueWake(RudeDrawerEventQueue* queue)
+{
+    syscall(SYS_futex, &queue->tail, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// Server only. Returns false when the queue is full, the event is dropped.
+inline bool eventQueuePush(RudeDrawerEventQueue* queue, RudeDrawerEvent const& event)
+{
+    auto tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) >= EVENT_QUEUE_SIZE)
+        return false;
+
+    queue->events[tail % EVENT_QUEUE_SIZE] = event;
+    // Sequentially consistent, so that either the client sees the event before
+    // going to sleep, or this sees that it went to sleep
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->waiting, __ATOMIC_SEQ_CST))
+        eventQueueWake(queue);
+    return true;
+}
+
+// Server only. The index the next event will be pushed at.
+inline uint32_t eventQueueTail(RudeDrawerEventQueue* queue)
+{
+    return __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+}
+
+// Whether the client popped every event before `index`.
+inline bool eventQueueConsumed(RudeDrawerEventQueue* queue, uint32_t index)
+{
+    return (int32_t)(__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - index) >= 0;
+}
+
+// Server only. Wakes the client up for good.
+inline void eventQueueClose(RudeDrawerEventQueue* queue)
+{
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_SEQ_CST);
+    eventQueueWake(queue);
+}
+
+// Client only. Returns false when the queue is empty.
+inline bool eventQueuePop(RudeDrawerEventQueue* queue, RudeDrawerEvent& event)
+{
+    auto head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST))
+        return false;
+
+    event = queue->events[head % EVENT_QUEUE_SIZE];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Client only. Sleeps until the queue is not empty or closed. Can return spuriously.
+inline void eventQueueWait(RudeDrawerEventQueue* queue)
+{
+    __atomic_store_n(&queue->waiting, 1, __ATOMIC_SEQ_CST);
+    auto tail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST);
+    if (tail == __atomic_load_n(&queue->head, __ATOMIC_RELAXED) && !__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &queue->tail, FUTEX_WAIT, tail, nullptr, nullptr, 0);
+    __atomic_store_n(&queue->waiting, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+// Message.h - Frames `RudeDrawerCommand`s and `RudeDrawerResponse`s (defined and documented in `RudeDrawer.h`)
+// into the messages of version 2 of the protocol, and back. Shared by the server and LibDraw.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "RudeDrawer.h"
+
+inline void messageWrite(std::vector<uint8_t>& out, void const* data, size_t size)
+{
+    auto bytes = (uint8_t const*)data;
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+// Reads the payload of a message in order, until it runs out.
+struct MessageReader {
+    uint8_t const* data;
+    size_t left;
+
+    bool read(void* value, size_t size)
+    {
+        if (size > left)
+            return false;
+        std::memcpy(value, data, size);
+        data += size;
+        left -= size;
+        return true;
+    }
+};
+
+// Reads the next message of the payload of a batch, whose payload starts at `payload`.
+// Returns false if it is cut short.
+inline bool readBatchMessage(MessageReader& reader, RudeDrawerMessageHeader& header, uint8_t const*& payload)
+{
+    if (!reader.read(&header, sizeof(header)) || header.length > reader.left)
+        return false;
+    payload = reader.data;
+    reader.data += header.length;
+    reader.left -= header.length;
+    return true;
+}
+
+inline bool commandHasWindowId(uint32_t kind)
+{
+    switch (kind) {
+    case RDCMD_REMOVE_WIN:
+    case RDCMD_START_POLLING_EVENTS_WIN:
+    case RDCMD_STOP_POLLING_EVENTS_WIN:
+    case RDCMD_GET_DISPLAY_SHM_WIN:
+    case RDCMD_SEND_PAINT_EVENT:
+    case RDCMD_GET_MOUSE_POSITION:
+    case RDCMD_DAMAGE_WIN:
+    case RDCMD_COMMIT_WIN:
+    case RDCMD_START_POLLING_EVENTS_SHM_WIN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline bool commandAddsWindow(uint32_t kind)
+{
+    return kind == RDCMD_ADD_WIN || kind == RDCMD_CREATE_SURFACE;
+}
+
+// Appends `command` framed as a message to `out`.
+inline void encodeCommand(RudeDrawerCommand const& command, uint32_t requestId, std::vector<uint8_t>& out)
+{
+    auto start = out.size();
+    RudeDrawerMessageHeader header = { (uint16_t)command.kind, 0, requestId, 0 };
+    messageWrite(out, &header, sizeof(header));
+
+    if (command.kind == RDCMD_ADD_WIN || command.kind == RDCMD_CREATE_SURFACE) {
+        uint32_t alwaysUpdating = command.windowAlwaysUpdating;
+        auto title = (char const*)command.windowTitle;
+        messageWrite(out, &command.windowDims, sizeof(command.windowDims));
+        messageWrite(out, &alwaysUpdating, sizeof(alwaysUpdating));
+        messageWrite(out, &command.windowBufferCount, sizeof(command.windowBufferCount));
+        if (command.kind == RDCMD_CREATE_SURFACE) {
+            uint32_t eventsSharedMemory = command.windowEventsSharedMemory;
+            messageWrite(out, &eventsSharedMemory, sizeof(eventsSharedMemory));
+        }
+        messageWrite(out, title, strnlen(title, WINDOW_TITLE_MAX - 1));
+    } else if (commandHasWindowId(command.kind)) {
+        messageWrite(out, &command.windowId, sizeof(command.windowId));
+        if (command.kind == RDCMD_DAMAGE_WIN)
+            messageWrite(out, command.damageRects, command.damageRectsCount * sizeof(RudeDrawerRect));
+    }
+
+    auto length = (uint32_t)(out.size() - start - sizeof(header));
+    std::memcpy(out.data() + start + offsetof(RudeDrawerMessageHeader, length), &length, sizeof(length));
+}
+
+// Fills the fields of `command` that its kind needs. Returns false if the payload
+// does not match them.
+inline bool decodeCommand(RudeDrawerMessageHeader const& header, uint8_t const* payload, RudeDrawerCommand& command)
+{
+    MessageReader reader = { payload, header.length };
+    command.kind = (RudeDrawerCommandKind)header.kind;
+
+    if (command.kind == RDCMD_ADD_WIN || command.kind == RDCMD_CREATE_SURFACE) {
+        uint32_t alwaysUpdating;
+        uint32_t eventsSharedMemory = 0;
+        if (!reader.read(&command.windowDims, sizeof(command.windowDims))
+            || !reader.read(&alwaysUpdating, sizeof(alwaysUpdating))
+            || !reader.read(&command.windowBufferCount, sizeof(command.windowBufferCount))
+            || (command.kind == RDCMD_CREATE_SURFACE && !reader.read(&eventsSharedMemory, sizeof(eventsSharedMemory)))
+            || reader.left >= WINDOW_TITLE_MAX)
+            return false;
+        command.windowAlwaysUpdating = alwaysUpdating;
+        command.windowEventsSharedMemory = eventsSharedMemory;
+        auto title = (char*)command.windowTitle;
+        std::memcpy(title, reader.data, reader.left);
+        title[reader.left] = '\0';
+        return true;
+    }
+
+    if (!commandHasWindowId(command.kind))
+        return reader.left == 0;
+    if (!reader.read(&command.windowId, sizeof(command.windowId)))
+        return false;
+
+    if (command.kind == RDCMD_DAMAGE_WIN) {
+        if (reader.left % sizeof(RudeDrawerRect) != 0 || reader.left > sizeof(command.damageRects))
+            return false;
+        command.damageRectsCount = reader.left / sizeof(RudeDrawerRect);
+        reader.read(command.damageRects, reader.left);
+    }
+    return reader.left == 0;
+}
+
+// Appends `response` framed as a message to `out`.
+inline void encodeResponse(RudeDrawerResponse const& response, uint32_t requestId, std::vector<uint8_t>& out)
+{
+    auto start = out.size();
+    RudeDrawerMessageHeader header = { (uint16_t)response.kind, (uint16_t)response.errorKind, requestId, 0 };
+    messageWrite(out, &header, sizeof(header));
+
+    switch (response.kind) {
+    case RDRESP_WINID:
+        messageWrite(out, &response.windowId, sizeof(response.windowId));
+        break;
+    case RDRESP_SURFACE:
+        messageWrite(out, &response.windowId, sizeof(response.windowId));
+        messageWrite(out, &response.windowBufferCount, sizeof(response.windowBufferCount));
+        messageWrite(out, &response.windowBufferIndex, sizeof(response.windowBufferIndex));
+        break;
+    case RDRESP_SHM_NAME:
+        messageWrite(out, &response.windowBufferCount, sizeof(response.windowBufferCount));
+        messageWrite(out, &response.windowBufferIndex, sizeof(response.windowBufferIndex));
+        messageWrite(out, response.windowShmName, strnlen(response.windowShmName, WINDOW_SHM_NAME_MAX - 1));
+        break;
+    case RDRESP_DIMENSIONS:
+        messageWrite(out, &response.dimensions, sizeof(response.dimensions));
+        break;
+    case RDRESP_MOUSE_POSITION:
+        messageWrite(out, &response.mousePos, sizeof(response.mousePos));
+        break;
+    case RDRESP_MOUSE_DELTA:
+        messageWrite(out, &response.mouseDelta, sizeof(response.mouseDelta));
+        break;
+    case RDRESP_BUFFER_INDEX:
+        messageWrite(out, &response.windowBufferIndex, sizeof(response.windowBufferIndex));
+        break;
+    case RDRESP_STATS:
+        messageWrite(out, &response.stats, sizeof(response.stats));
+        break;
+    case RDRESP_EMPTY:
+    // Made of other responses, see `decodeBatchResponses()`
+    case RDRESP_BATCH:
+        break;
+    }
+
+    auto length = (uint32_t)(out.size() - start - sizeof(header));
+    std::memcpy(out.data() + start + offsetof(RudeDrawerMessageHeader, length), &length, sizeof(length));
+}
+
+// Fills the fields of `response` that its kind has. Returns false if the payload
+// does not match them.
+inline bool decodeResponse(RudeDrawerMessageHeader const& header, uint8_t const* payload, RudeDrawerResponse& response)
+{
+    MessageReader reader = { payload, header.length };
+    response.kind = (RudeDrawerResponseKind)header.kind;
+    response.errorKind = (RudeDrawerErrorKind)header.errorKind;
+
+    auto ok = true;
+    switch (response.kind) {
+    case RDRESP_WINID:
+        ok = reader.read(&response.windowId, sizeof(response.windowId));
+        break;
+    case RDRESP_SURFACE:
+        ok = reader.read(&response.windowId, sizeof(response.windowId))
+            && reader.read(&response.windowBufferCount, sizeof(response.windowBufferCount))
+            && reader.read(&response.windowBufferIndex, sizeof(response.windowBufferIndex));
+        break;
+    case RDRESP_SHM_NAME:
+        if (!reader.read(&response.windowBufferCount, sizeof(response.windowBufferCount))
+            || !reader.read(&response.windowBufferIndex, sizeof(response.windowBufferIndex))
+            || reader.left >= WINDOW_SHM_NAME_MAX)
+            return false;
+        std::memcpy(response.windowShmName, reader.data, reader.left);
+        response.windowShmName[reader.left] = '\0';
+        return true;
+    case RDRESP_DIMENSIONS:
+        ok = reader.read(&response.dimensions, sizeof(response.dimensions));
+        break;
+    case RDRESP_MOUSE_POSITION:
+        ok = reader.read(&response.mousePos, sizeof(response.mousePos));
+        break;
+    case RDRESP_MOUSE_DELTA:
+        ok = reader.read(&response.mouseDelta, sizeof(response.mouseDelta));
+        break;
+    case RDRESP_BUFFER_INDEX:
+        ok = reader.read(&response.windowBufferIndex, sizeof(response.windowBufferIndex));
+        break;
+    case RDRESP_STATS:
+        ok = reader.read(&response.stats, sizeof(response.stats));
+        break;
+    case RDRESP_EMPTY:
+        break;
+    default:
+        return false;
+    }
+    return ok && reader.left == 0;
+}
+
+// Fills `responses` with the responses in the payload of an `RDRESP_BATCH`, at the
+// index of their command. Returns false if the payload is malformed.
+inline bool decodeBatchResponses(RudeDrawerMessageHeader const& header, uint8_t const* payload,
+    std::vector<RudeDrawerResponse>& responses)
+{
+    MessageReader reader = { payload, header.length };
+    while (reader.left > 0) {
+        RudeDrawerMessageHeader responseHeader;
+        uint8_t const* responsePayload;
+        if (!readBatchMessage(reader, responseHeader, responsePayload)
+            || responseHeader.requestId >= responses.size()
+            || !decodeResponse(responseHeader, responsePayload, responses[responseHeader.requestId]))
+            return false;
+    }
+    return true;
+}
@@ -1,13 +1,16 @@
 #pragma once
 
 // RudeDrawer.h - Contains definitions of structures and constants used by the AppDrawer server to communicate with its clients.
-// If you want to do anything with the server, start by sending a `RudeDrawerCommand` (defined and documented in this header) to it.
+// If you want to do anything with the server, start by sending a `RudeDrawerCommand` (defined and documented in this header) to it,
+// or a `RudeDrawerHello` to speak the framed version of the protocol (see `PROTOCOL_VERSION`).
 
 #include <stdint.h>
 #include <stdbool.h>
 
 #define SOCKET_PATH "/tmp/AppDrawer.sock"
 // RGBA
+// Windows are assumed to be opaque: translucent pixels blend with whatever is beneath them,
+// but windows that are entirely covered by other windows are neither drawn nor painted.
 #define COMPONENTS 4
 
 // These are all of the command types that can be sent to AppDrawer.
@@ -20,8 +23,10 @@ typedef enum {
     RDCMD_PING,
     // Adds a Window.
     // Required arguments:
-    //   - `windowDims`
+    //   - `windowDims` (from 1 to `WINDOW_DIMENSION_MAX`)
     //   - `windowTitle` (has to fit in `WINDOW_TITLE_MAX`)
+    //   - `windowAlwaysUpdating`
+    //   - `windowBufferCount` (from 1 to `WINDOW_BUFFERS_MAX`, 0 means 1)
     // Returns: `RDRESP_WINID`
     RDCMD_ADD_WIN,
     // Removes a window.
@@ -41,13 +46,18 @@ typedef enum {
     //   - `windowId`
     // Returns: `RDRESP_EMPTY`
     RDCMD_STOP_POLLING_EVENTS_WIN,
-    // Returns the name of a shared memory that contains the pixels of the specified window
+    // Returns a shared memory that contains the pixels of the specified window
     // (specified by `windowId`).
+    // The shared memory holds `windowBufferCount` buffers of `width * height * COMPONENTS`
+    // bytes back to back. The client draws into the buffer at `windowBufferIndex`.
     // Required arguments:
     //   - `windowId`
     // Returns: `RDRESP_SHM_NAME`
     RDCMD_GET_DISPLAY_SHM_WIN,
-    // Makes the server send a paint event to the specified window (specified by `windowId`).
+    // Makes the server send a paint event to the specified window (specified by `windowId`)
+    // with its next frame. Requests made before it is sent collapse into one.
+    // If the window is entirely covered by other windows, the event is held back until
+    // it is exposed again.
     // Required arguments:
     //   - `windowId`
     // Returns: None
@@ -61,6 +71,59 @@ typedef enum {
     // Required arguments: None
     // Returns: `RDRESP_MOUSE_DELTA`
     RDCMD_GET_MOUSE_DELTA,
+    // Reports which regions of the specified window's (specified by `windowId`) pixels
+    // changed since the last frame.
+    // Once a window has reported damage, the server only uploads the reported regions.
+    // Windows that never report damage are uploaded as a whole on every frame.
+    // Required arguments:
+    //   - `windowId`
+    //   - `damageRects` (at most `DAMAGE_RECTS_MAX`, in window coordinates)
+    //   - `damageRectsCount`
+    // Returns: None
+    RDCMD_DAMAGE_WIN,
+    // Makes the buffer that the client has been drawing into the one shown by the
+    // server, along with the damage reported since the last commit.
+    // The returned buffer is not read by the server until it is committed. With two
+    // buffers, the response waits for the server to finish reading the buffer being
+    // returned, without holding up other clients. In an `RDCMD_BATCH`, which cannot
+    // wait, the commit fails with `RDERROR_BUFFER_BUSY` instead.
+    // Single-buffered windows always get the same buffer back.
+    // Required arguments:
+    //   - `windowId`
+    // Returns: `RDRESP_BUFFER_INDEX`
+    RDCMD_COMMIT_WIN,
+    // Returns how long the phases of the most recent frames of the server took.
+    // Required arguments: None
+    // Returns: `RDRESP_STATS`
+    RDCMD_GET_STATS,
+    // Like `RDCMD_START_POLLING_EVENTS_WIN`, but the server writes events to a queue in
+    // shared memory instead of sending them over a socket, so that they can be read
+    // without any system call. The queue is a `RudeDrawerEventQueue` (defined and
+    // documented in this header), in the returned shared memory. It stays valid until
+    // the window is removed.
+    // Required arguments:
+    //   - `windowId`
+    // Returns: `RDRESP_SHM_NAME`
+    RDCMD_START_POLLING_EVENTS_SHM_WIN,
+    // Runs many commands in order, at once: no frame of the server sees only some of
+    // them done. Only in version 2 of the protocol (see `PROTOCOL_VERSION`).
+    // The `windowId` of a command can be `BATCH_RESULT(index)`, the window of the
+    // command at `index` in the same batch (the one it added, or the one it was about).
+    // Required arguments:
+    //   - the commands (at most `BATCH_COMMANDS_MAX`), in the payload
+    // Returns: `RDRESP_BATCH`
+    RDCMD_BATCH,
+    // Adds a window that is ready to be drawn into and sends its events, in a single
+    // round trip: `RDCMD_ADD_WIN`, `RDCMD_GET_DISPLAY_SHM_WIN` and
+    // `RDCMD_START_POLLING_EVENTS_WIN` (or `RDCMD_START_POLLING_EVENTS_SHM_WIN`) at once.
+    // The pixels come as `shmFd`, and the events as `eventFd`: a connected socket sending
+    // `RudeDrawerEvent`s, or with `windowEventsSharedMemory`, the shared memory of a
+    // `RudeDrawerEventQueue` (defined and documented in this header).
+    // Required arguments:
+    //   - the arguments of `RDCMD_ADD_WIN`
+    //   - `windowEventsSharedMemory`
+    // Returns: `RDRESP_SURFACE`
+    RDCMD_CREATE_SURFACE,
 } RudeDrawerCommandKind;
 
 // This is a struct that contains two `uint32_t`s.
@@ -71,8 +134,23 @@ typedef struct {
     int y;
 } RudeDrawerVec2D;
 
+// This is a struct that describes a rectangle.
+typedef struct {
+    // x
+    int x;
+    // y
+    int y;
+    // width
+    int width;
+    // height
+    int height;
+} RudeDrawerRect;
+
 // This is a struct that, when sent over `SOCKET_PATH`, makes the server execute a command.
 #define WINDOW_TITLE_MAX 256
+#define DAMAGE_RECTS_MAX 16
+#define WINDOW_BUFFERS_MAX 3
+#define WINDOW_DIMENSION_MAX 16384
 typedef struct {
     // The kind of command.
     // Type: `RudeDrawerCommandKind` (defined and documented in this header)
@@ -86,6 +164,24 @@ typedef struct {
     // The ID of a window.
     // Type: `uint32_t`
     uint32_t windowId;
+    // Whether a window wants to draw continuously. If so, the server sends it a
+    // `RDEVENT_FRAME` event after every frame in which it is visible.
+    // Type: `bool`
+    bool windowAlwaysUpdating;
+    // The number of pixel buffers of a window. Windows with more than one buffer
+    // only show what the client committed with `RDCMD_COMMIT_WIN`.
+    // Type: `uint32_t`
+    uint32_t windowBufferCount;
+    // Whether the events of a window go to a queue in shared memory instead of a
+    // socket, see `RDCMD_CREATE_SURFACE`.
+    // Type: `bool`
+    bool windowEventsSharedMemory;
+    // The regions of a window that changed.
+    // Type: `RudeDrawerRect[DAMAGE_RECTS_MAX]` (defined and documented in this header)
+    RudeDrawerRect damageRects[DAMAGE_RECTS_MAX];
+    // The number of used entries in `damageRects`.
+    // Type: `uint32_t`
+    uint32_t damageRectsCount;
 } RudeDrawerCommand;
 
 // These are the possible kinds of response.
@@ -94,7 +190,9 @@ typedef enum {
     RDRESP_EMPTY,
     // The ID of a window.
     RDRESP_WINID,
-    // The name of a shared memory.
+    // A shared memory, passed as a file descriptor along with the response (as
+    // `SCM_RIGHTS` ancillary data of the bytes of the response), that the receiver
+    // owns. Its size is sealed, it can be mapped but not resized.
     RDRESP_SHM_NAME,
     // The dimensions of a window.
     RDRESP_DIMENSIONS,
@@ -102,6 +200,15 @@ typedef enum {
     RDRESP_MOUSE_POSITION,
     // The mouse position delta between frames.
     RDRESP_MOUSE_DELTA,
+    // The buffer of a window that the client should draw into.
+    RDRESP_BUFFER_INDEX,
+    // Timings of the frames of the server.
+    RDRESP_STATS,
+    // The responses to the commands of an `RDCMD_BATCH`.
+    RDRESP_BATCH,
+    // A window, with the shared memory of its pixels and its events, see
+    // `RDCMD_CREATE_SURFACE`. Both are passed like with `RDRESP_SHM_NAME`, in this order.
+    RDRESP_SURFACE,
 } RudeDrawerResponseKind;
 
 // These are all of the possible error codes.
@@ -117,8 +224,54 @@ typedef enum {
     RDERROR_CANT_POLL_EVENTS,
     // No error happened.
     RDERROR_OK,
+    // Indicates that `RDCMD_COMMIT_WIN` could not wait for the buffer it returns,
+    // and did nothing. The client can try again later.
+    RDERROR_BUFFER_BUSY,
 } RudeDrawerErrorKind;
 
+// These are the phases of a frame of the server, timed by `RDCMD_GET_STATS`.
+typedef enum {
+    // Uploading the pixels of windows to the GPU.
+    RDPHASE_UPLOAD,
+    // Drawing the windows. With the software backend, this is the whole composite.
+    RDPHASE_DRAW,
+    // Handling and drawing the decorations of windows.
+    RDPHASE_DECORATION,
+    // Sending key and mouse events to the active window.
+    RDPHASE_INPUT,
+    // Changing the active window.
+    RDPHASE_FOCUS,
+    // Presenting the frame (`EndDrawing()`).
+    RDPHASE_PRESENT,
+    // The whole frame, from its start to the start of the next one.
+    RDPHASE_FRAME,
+    RDPHASE_COUNT,
+} RudeDrawerPhase;
+
+// This is a struct that describes how long a phase of a frame took, in microseconds.
+typedef struct {
+    // Median
+    uint32_t p50;
+    // 99th percentile
+    uint32_t p99;
+    // Maximum
+    uint32_t max;
+} RudeDrawerPhaseStats;
+
+// This is a struct that describes the timings of the most recent frames of the server.
+typedef struct {
+    // The number of frames the timings were taken from.
+    // Type: `uint32_t`
+    uint32_t frames;
+    // The timings of every phase, indexed by `RudeDrawerPhase`.
+    // Type: `RudeDrawerPhaseStats[RDPHASE_COUNT]` (defined and documented in this header)
+    RudeDrawerPhaseStats phases[RDPHASE_COUNT];
+    // The number of mouse moves, paints and frames that were merged into a pending
+    // one of the same kind, because the client was behind, since the server started.
+    // Type: `uint64_t`
+    uint64_t coalescedEvents;
+} RudeDrawerStats;
+
 // This is a struct that can be returned by some commands.
 #define WINDOW_SHM_NAME_MAX 256
 typedef struct {
@@ -131,9 +284,15 @@ typedef struct {
     // The ID of a window.
     // Type: `uint32_t`
     uint32_t windowId;
-    // The name of a shared memory that contains the pixels of a window.
+    // The name of a shared memory, only meant for logs: it cannot be opened.
     // Type: `char[WINDOW_SHM_NAME_MAX]`
     char windowShmName[WINDOW_SHM_NAME_MAX];
+    // The number of pixel buffers in the shared memory of a window.
+    // Type: `uint32_t`
+    uint32_t windowBufferCount;
+    // The buffer of a window that the client should draw into.
+    // Type: `uint32_t`
+    uint32_t windowBufferIndex;
     // The dimensions of a window.
     // Type: `RudeDrawerVec2D` (defined and documented in this header)
     RudeDrawerVec2D dimensions;
@@ -143,8 +302,80 @@ typedef struct {
     // The mouse position delta between frames.
     // Type: `RudeDrawerVec2D` (defined and documented in this header)
     RudeDrawerVec2D mouseDelta;
+    // The timings of the most recent frames of the server.
+    // Type: `RudeDrawerStats` (defined and documented in this header)
+    RudeDrawerStats stats;
+    // The file descriptor of a shared memory, received along with the response.
+    // Its value is not sent, it is only valid in the process that received it.
+    // Type: `int`
+    int shmFd;
+    // The file descriptor of the events of a window, received like `shmFd`.
+    // Type: `int`
+    int eventFd;
 } RudeDrawerResponse;
 
+// Version 1 of the protocol sends every `RudeDrawerCommand` and `RudeDrawerResponse` as
+// it is, whatever the command needs. Version 2 frames them as a `RudeDrawerMessageHeader`
+// (defined and documented in this header) followed by a payload holding only what the
+// command or response needs.
+// A client speaking version 2 sends a `RudeDrawerHello` (defined and documented in this
+// header) as soon as it connects, and waits for the one the server answers with, that
+// holds the version both speak. A client that sends a command instead speaks version 1.
+#define PROTOCOL_MAGIC 0x32564452
+#define PROTOCOL_VERSION 2
+typedef struct {
+    // Always `PROTOCOL_MAGIC`.
+    // Type: `uint32_t`
+    uint32_t magic;
+    // The highest version the sender speaks, or the one chosen by the server.
+    // Type: `uint32_t`
+    uint32_t version;
+} RudeDrawerHello;
+
+// Payloads are laid out as follows, without padding, in the byte order of the machine:
+//   - `RDCMD_ADD_WIN`: `windowDims`, `windowAlwaysUpdating` (as a `uint32_t`),
+//     `windowBufferCount`, then the title, without terminator
+//   - `RDCMD_CREATE_SURFACE`: like `RDCMD_ADD_WIN`, with `windowEventsSharedMemory` (as a
+//     `uint32_t`) before the title
+//   - `RDCMD_DAMAGE_WIN`: `windowId`, then `damageRects` (at most `DAMAGE_RECTS_MAX`)
+//   - other commands that have a `windowId` argument: `windowId`
+//   - other commands: nothing
+//   - `RDRESP_WINID`: `windowId`
+//   - `RDRESP_SHM_NAME`: `windowBufferCount`, `windowBufferIndex`, then the name,
+//     without terminator (`shmFd` travels as ancillary data)
+//   - `RDRESP_DIMENSIONS`: `dimensions`
+//   - `RDRESP_MOUSE_POSITION`: `mousePos`
+//   - `RDRESP_MOUSE_DELTA`: `mouseDelta`
+//   - `RDRESP_BUFFER_INDEX`: `windowBufferIndex`
+//   - `RDRESP_STATS`: `stats`
+//   - `RDRESP_SURFACE`: `windowId`, `windowBufferCount`, `windowBufferIndex` (`shmFd`
+//     and `eventFd` travel as ancillary data)
+//   - `RDRESP_EMPTY`: nothing
+//   - `RDCMD_BATCH`: the commands, each a `RudeDrawerMessageHeader` and its payload,
+//     whose `requestId` is ignored
+//   - `RDRESP_BATCH`: the responses of the commands that return one, each a
+//     `RudeDrawerMessageHeader` and its payload, whose `requestId` is the index of its
+//     command in the batch
+// The server closes the connection of clients sending more than `MESSAGE_PAYLOAD_MAX` bytes.
+// Responses to batches can be larger.
+#define MESSAGE_PAYLOAD_MAX (64 * 1024)
+#define BATCH_COMMANDS_MAX 256
+#define BATCH_RESULT(index) (0x80000000u | (uint32_t)(index))
+typedef struct {
+    // The kind of command or response.
+    // Type: `RudeDrawerCommandKind` or `RudeDrawerResponseKind` (defined and documented in this header)
+    uint16_t kind;
+    // Contains the error code of the performed operation, 0 in commands.
+    // Type: `RudeDrawerErrorKind` (defined and documented in this header)
+    uint16_t errorKind;
+    // Chosen by the client, and copied into the response to the command.
+    // Type: `uint32_t`
+    uint32_t requestId;
+    // The number of bytes of payload following the header.
+    // Type: `uint32_t`
+    uint32_t length;
+} RudeDrawerMessageHeader;
+
 // These are all the keyboard keys.
 typedef enum {
     RDKEY_NULL            = 0,
@@ -267,6 +498,14 @@ typedef enum {
     RDMOUSE_MIDDLE,
 } RudeDrawerMouseButton;
 
+// These are the modifier keys, as flags.
+typedef enum {
+    RDMOD_SHIFT   = 1 << 0,
+    RDMOD_CONTROL = 1 << 1,
+    RDMOD_ALT     = 1 << 2,
+    RDMOD_SUPER   = 1 << 3,
+} RudeDrawerModifier;
+
 // These are all of the possible event kinds.
 typedef enum {
     // No event.
@@ -285,9 +524,16 @@ typedef enum {
     RDEVENT_MOUSERELEASE,
     // The mouse has moved.
     RDEVENT_MOUSEMOVE,
+    // The server composited a frame, windows that are always updating should draw
+    // their next one.
+    RDEVENT_FRAME,
 } RudeDrawerEventKind;
 
 // This struct defines an event that can be sent to a client.
+// While a client has not read the events of previous frames, `RDEVENT_MOUSEMOVE`,
+// `RDEVENT_PAINT` and `RDEVENT_FRAME` events are held back, and collapse into the
+// latest one of their kind. All the other events are delivered in order, after the
+// held events that came before them.
 typedef struct {
     // The kind of event.
     // Type: `RudeDrawerEventKind` (defined and documented in this header)
@@ -298,4 +544,43 @@ typedef struct {
     // A mouse button.
     // Type: `RudeDrawerMouseButton` (defined and documented in this header)
     RudeDrawerMouseButton mouseButton;
+    // The position of the cursor within the window when the input happened. It can be
+    // outside of the window. Always zero for events that are not caused by input.
+    // Type: `RudeDrawerVec2D` (defined and documented in this header)
+    RudeDrawerVec2D mousePos;
+    // The modifier keys held down when the input happened.
+    // Type: `uint32_t`, a combination of `RudeDrawerModifier` (defined and documented in this header)
+    uint32_t modifiers;
+    // When the input happened, or when the event was sent if it is not caused by input,
+    // in microseconds of `CLOCK_MONOTONIC`.
+    // Type: `uint64_t`
+    uint64_t timestamp;
 } RudeDrawerEvent;
+
+// This struct is a queue of events in shared memory, see `RDCMD_START_POLLING_EVENTS_SHM_WIN`.
+// It is a single-producer/single-consumer ring: only the server writes `tail`, and only the
+// client writes `head`. Both only grow, and wrap around at `UINT32_MAX`. The event of index `i`
+// is `events[i % EVENT_QUEUE_SIZE]`. Every field except `events` must be accessed atomically.
+// When the queue is empty, the client sets `waiting`, checks `tail` again and sleeps on it with
+// a futex. The server only wakes it up (`FUTEX_WAKE` on `tail`) when `waiting` is set.
+// Once the server stops sending events, it sets `closed` and wakes the client up.
+#define EVENT_QUEUE_SIZE 1024
+typedef struct {
+    // The index of the next event the client reads.
+    // Type: `uint32_t`
+    uint32_t head;
+    uint32_t headPadding[15];
+    // The index of the next event the server writes.
+    // Type: `uint32_t`
+    uint32_t tail;
+    // Whether the client is, or is about to be, sleeping on `tail`.
+    // Type: `uint32_t`
+    uint32_t waiting;
+    // Whether the server stopped sending events.
+    // Type: `uint32_t`
+    uint32_t closed;
+    uint32_t tailPadding[13];
+    // The events.
+    // Type: `RudeDrawerEvent[EVENT_QUEUE_SIZE]` (defined and documented in this header)
+    RudeDrawerEvent events[EVENT_QUEUE_SIZE];
+} RudeDrawerEventQueue;
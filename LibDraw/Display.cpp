@@ -1,42 +1,54 @@
 #include "LibDraw/Display.h"
+#include "LibDraw/Draw.h"
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
-#include <fcntl.h>
 #include <sstream>
-#include <string>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include "RudeDrawer.h"
 
-Display::Display(std::string name, uint32_t width, uint32_t height, uint32_t id) noexcept(false)
+Display::Display(Draw* draw, int shmFd, uint32_t width, uint32_t height, uint32_t id,
+    uint32_t bufferCount, uint32_t backBuffer) noexcept(false)
 {
+    m_draw = draw;
     m_windowId = id;
+    // Windows can take gigabytes
+    m_bufferSize = (size_t)width * height * COMPONENTS;
+    m_bufferCount = bufferCount;
+    m_backBuffer = backBuffer;
+    m_pixelsShmFd = shmFd;
+    m_pixelsShmSize = m_bufferSize * (size_t)m_bufferCount;
 
-    m_pixelsShmFd = shm_open(name.c_str(), O_RDWR, 0666);
-    if (m_pixelsShmFd == -1) {
-        std::ostringstream error;
-        error << "ERROR: could not open shared memory for window of ID `"
-              << m_windowId << "`: " << strerror(errno);
-        throw std::runtime_error(error.str());
-    }
-
-    m_pixelsShmSize = width * height * COMPONENTS;
-
-    m_pixels = (uint8_t*)mmap(NULL, m_pixelsShmSize, PROT_READ | PROT_WRITE,
+    m_buffers = (uint8_t*)mmap(NULL, m_pixelsShmSize, PROT_READ | PROT_WRITE,
                             MAP_SHARED, m_pixelsShmFd, 0);
-    if (m_pixels == MAP_FAILED) {
+    if (m_buffers == MAP_FAILED) {
         std::ostringstream error;
         error << "ERROR: could not mmap shared memory for window of ID `"
               << m_windowId << "`: " << strerror(errno);
+        close(m_pixelsShmFd);
         throw std::runtime_error(error.str());
     }
+
+    m_pixels = m_buffers + (size_t)m_backBuffer * m_bufferSize;
+}
+
+void Display::commit() noexcept(false)
+{
+    m_backBuffer = m_draw->commit(m_windowId);
+    m_pixels = m_buffers + (size_t)m_backBuffer * m_bufferSize;
+}
+
+uint32_t Display::bufferCount() noexcept(true)
+{
+    return m_bufferCount;
 }
 
 void Display::destroy() noexcept(false)
 {
-    if (munmap(m_pixels, m_pixelsShmSize) == -1) {
+    if (munmap(m_buffers, m_pixelsShmSize) == -1) {
         std::ostringstream error;
         error << "ERROR: could not munmap shared memory for window of ID `"
               << m_windowId << "`: " << strerror(errno);
@@ -1,20 +1,29 @@
 #include "LibDraw/Draw.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <cstring>
+#include <fcntl.h>
+#include <future>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <mutex>
 #include <thread>
+#include <type_traits>
 #include <unistd.h>
 
+#include "EventQueue.h"
+#include "Message.h"
 #include "RudeDrawer.h"
 
-void Draw::send(void* data, int n) noexcept(false)
+void Draw::send(void const* data, int n) noexcept(false)
 {
     if (::send(m_socket, data, n, 0) < 0) {
         std::ostringstream error;
@@ -24,15 +33,235 @@ void Draw::send(void* data, int n) noexcept(false)
     }
 }
 
+// The most file descriptors received along with one `recvmsg()` (`SCM_MAX_FD`)
+#define DRAW_RECEIVED_FDS_MAX 253
+
 void Draw::recv(void* data, int n) noexcept(false)
 {
-    auto numOfBytesRecvd = ::recv(m_socket, data, n, 0);
-    if (numOfBytesRecvd < 0) {
-        std::ostringstream error;
-        error << "ERROR: could not receive data from server: "
-              << strerror(errno);
-        close(m_socket);
-        throw std::runtime_error(error.str());
+    auto bytes = (uint8_t*)data;
+    while (n > 0) {
+        iovec iov = { bytes, (size_t)n };
+        union {
+            char buffer[CMSG_SPACE(DRAW_RECEIVED_FDS_MAX * sizeof(int))];
+            cmsghdr align;
+        } control;
+        msghdr message = { };
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+
+        auto numOfBytesRecvd = ::recvmsg(m_socket, &message, MSG_CMSG_CLOEXEC);
+        if (numOfBytesRecvd > 0) {
+            for (auto header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+                if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+                    continue;
+                auto count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; ++i) {
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                    m_receivedFds.push_back(fd);
+                }
+            }
+            if (message.msg_flags & MSG_CTRUNC)
+                throw std::runtime_error("ERROR: received too many file descriptors");
+        }
+        if (numOfBytesRecvd < 0) {
+            if (errno == EINTR)
+                continue;
+            std::ostringstream error;
+            error << "ERROR: could not receive data from server: "
+                  << strerror(errno);
+            throw std::runtime_error(error.str());
+        }
+        if (numOfBytesRecvd == 0) {
+            throw std::runtime_error("ERROR: server closed the connection");
+        }
+        bytes += numOfBytesRecvd;
+        n -= numOfBytesRecvd;
+    }
+}
+
+uint32_t Draw::nextRequestId() noexcept(true)
+{
+    auto requestId = m_nextRequestId++;
+    // 0 is never waited for
+    if (m_nextRequestId == 0)
+        m_nextRequestId = 1;
+    return requestId;
+}
+
+uint32_t Draw::post(RudeDrawerCommand* command) noexcept(false)
+{
+    auto requestId = nextRequestId();
+
+    if (m_version == 1) {
+        send(command, sizeof(RudeDrawerCommand));
+        return requestId;
+    }
+
+    m_message.clear();
+    encodeCommand(*command, requestId, m_message);
+    send(m_message.data(), m_message.size());
+    return requestId;
+}
+
+template<typename F>
+void Draw::submitPending(DrawPending pending, F&& post) noexcept(false)
+{
+    std::lock_guard<std::mutex> guard(m_socketMutex);
+
+    // Registered first, as the response can arrive before `post()` returns
+    auto requestId = m_nextRequestId;
+    {
+        std::lock_guard<std::mutex> pendingGuard(m_pendingMutex);
+        if (m_disconnected)
+            throw std::runtime_error("ERROR: not connected to the server");
+        m_pending[requestId] = std::move(pending);
+    }
+
+    try {
+        post();
+    } catch (std::runtime_error&) {
+        std::lock_guard<std::mutex> pendingGuard(m_pendingMutex);
+        m_pending.erase(requestId);
+        throw;
+    }
+}
+
+void Draw::submit(RudeDrawerCommand* command, DrawCompletion completion) noexcept(false)
+{
+    submitPending(DrawPending { std::move(completion) }, [&] {
+        post(command);
+    });
+}
+
+template<typename T, typename F>
+std::future<T> Draw::requestAsync(RudeDrawerCommand* command, F&& extract) noexcept(false)
+{
+    auto promise = std::make_shared<std::promise<T>>();
+    auto future = promise->get_future();
+
+    submit(command, [promise, extract = std::forward<F>(extract)](RudeDrawerResponse const* response) {
+        if (response == nullptr) {
+            promise->set_exception(std::make_exception_ptr(
+                std::runtime_error("ERROR: lost the connection to the server")));
+            return;
+        }
+
+        try {
+            if constexpr (std::is_void_v<T>) {
+                extract(*response);
+                promise->set_value();
+            } else {
+                promise->set_value(extract(*response));
+            }
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return future;
+}
+
+std::future<RudeDrawerResponse> Draw::submit(RudeDrawerCommand* command) noexcept(false)
+{
+    return requestAsync<RudeDrawerResponse>(command, [](RudeDrawerResponse const& response) {
+        return response;
+    });
+}
+
+RudeDrawerResponse Draw::request(RudeDrawerCommand* command) noexcept(false)
+{
+    return submit(command).get();
+}
+
+int Draw::popReceivedFd() noexcept(false)
+{
+    if (m_receivedFds.empty())
+        throw std::runtime_error("ERROR: received a response without its file descriptor");
+    auto fd = m_receivedFds.front();
+    m_receivedFds.pop_front();
+    return fd;
+}
+
+void Draw::takeReceivedFds(RudeDrawerResponse& response) noexcept(false)
+{
+    response.shmFd = -1;
+    response.eventFd = -1;
+    if (response.errorKind != RDERROR_OK)
+        return;
+
+    // The server passes them in the order of their responses, pixels first
+    if (response.kind == RDRESP_SHM_NAME || response.kind == RDRESP_SURFACE)
+        response.shmFd = popReceivedFd();
+    if (response.kind == RDRESP_SURFACE)
+        response.eventFd = popReceivedFd();
+}
+
+void Draw::receiveResponses() noexcept(true)
+{
+    std::vector<uint8_t> payload;
+    try {
+        while (true) {
+            RudeDrawerResponse response;
+            RudeDrawerMessageHeader header = { };
+            if (m_version == 1) {
+                recv(&response, sizeof(RudeDrawerResponse));
+            } else {
+                recv(&header, sizeof(header));
+                payload.resize(header.length);
+                recv(payload.data(), header.length);
+            }
+
+            DrawPending pending;
+            {
+                std::lock_guard<std::mutex> guard(m_pendingMutex);
+                // Responses of version 1 come in the order of their commands
+                auto it = m_version == 1 ? m_pending.begin() : m_pending.find(header.requestId);
+                if (it == m_pending.end())
+                    throw std::runtime_error("ERROR: received a response to no request");
+                pending = std::move(it->second);
+                m_pending.erase(it);
+            }
+
+            if (m_version != 1) {
+                auto ok = false;
+                if (header.kind == RDRESP_BATCH) {
+                    response.kind = RDRESP_BATCH;
+                    response.errorKind = (RudeDrawerErrorKind)header.errorKind;
+                    ok = pending.batchResponses != nullptr
+                        && decodeBatchResponses(header, payload.data(), *pending.batchResponses);
+                } else {
+                    ok = decodeResponse(header, payload.data(), response);
+                }
+                if (!ok) {
+                    pending.completion(nullptr);
+                    throw std::runtime_error("ERROR: received a malformed response");
+                }
+            }
+
+            if (response.kind == RDRESP_BATCH && pending.batchResponses != nullptr) {
+                for (auto& batchResponse : *pending.batchResponses) {
+                    takeReceivedFds(batchResponse);
+                }
+            }
+            takeReceivedFds(response);
+            pending.completion(&response);
+        }
+    } catch (std::runtime_error& error) {
+        std::lock_guard<std::mutex> guard(m_pendingMutex);
+        if (!m_disconnected)
+            std::cerr << error.what() << "\n";
+    }
+
+    std::map<uint32_t, DrawPending> pending;
+    {
+        std::lock_guard<std::mutex> guard(m_pendingMutex);
+        m_disconnected = true;
+        pending.swap(m_pending);
+    }
+    for (auto& [requestId, entry] : pending) {
+        entry.completion(nullptr);
     }
 }
 
@@ -44,7 +273,42 @@ void Draw::recv(void* data, int n) noexcept(false)
         throw std::runtime_error(error.str());          \
     }                                                   \
 
-void Draw::connect() noexcept(false)
+static char const* responseKindName(RudeDrawerResponseKind kind) noexcept(true)
+{
+    switch (kind) {
+    case RDRESP_EMPTY: return "RDRESP_EMPTY";
+    case RDRESP_WINID: return "RDRESP_WINID";
+    case RDRESP_SHM_NAME: return "RDRESP_SHM_NAME";
+    case RDRESP_DIMENSIONS: return "RDRESP_DIMENSIONS";
+    case RDRESP_MOUSE_POSITION: return "RDRESP_MOUSE_POSITION";
+    case RDRESP_MOUSE_DELTA: return "RDRESP_MOUSE_DELTA";
+    case RDRESP_BUFFER_INDEX: return "RDRESP_BUFFER_INDEX";
+    case RDRESP_STATS: return "RDRESP_STATS";
+    case RDRESP_BATCH: return "RDRESP_BATCH";
+    case RDRESP_SURFACE: return "RDRESP_SURFACE";
+    }
+    return "unknown";
+}
+
+// Throws unless the command of `function` succeeded with a response of `kind`.
+static void expectResponse(RudeDrawerResponse const& response, RudeDrawerResponseKind kind,
+    char const* function) noexcept(false)
+{
+    if (response.errorKind != RDERROR_OK) {
+        std::ostringstream error;
+        error << "ERROR: " << function
+              << ": Not OK: Code " << response.errorKind;
+        throw std::runtime_error(error.str());
+    }
+
+    if (response.kind != kind) {
+        std::ostringstream error;
+        error << "ERROR: response is not of kind `" << responseKindName(kind) << "`";
+        throw std::runtime_error(error.str());
+    }
+}
+
+void Draw::connect(uint32_t version) noexcept(false)
 {
     std::cout << "[INFO] Connecting to AppDrawer server...\n";
 
@@ -68,31 +332,53 @@ void Draw::connect() noexcept(false)
         close(m_socket);
         throw std::runtime_error(error.str());
     }
+
+    m_version = 1;
+    if (version >= 2) {
+        RudeDrawerHello hello = { PROTOCOL_MAGIC, version };
+        send(&hello, sizeof(hello));
+        recv(&hello, sizeof(hello));
+        if (hello.magic != PROTOCOL_MAGIC || hello.version == 0 || hello.version > version) {
+            close(m_socket);
+            throw std::runtime_error("ERROR: server answered with an invalid `RudeDrawerHello`");
+        }
+        m_version = hello.version;
+    }
+
+    m_receiver = std::thread(&Draw::receiveResponses, this);
 }
 
 void Draw::ping() noexcept(false)
+{
+    pingAsync().get();
+}
+
+std::future<void> Draw::pingAsync() noexcept(false)
 {
     RudeDrawerCommand command;
     command.kind = RDCMD_PING;
-    send(&command, sizeof(RudeDrawerCommand));
-
-    RudeDrawerResponse response;
-    recv(&response, sizeof(RudeDrawerResponse));
+    return requestAsync<void>(&command, [](RudeDrawerResponse const& response) {
+        expectResponse(response, RDRESP_EMPTY, "ping");
+    });
+}
 
-    NOTOK(response);
+// Copies `title` into the command that adds a window, cut to fit in
+// `WINDOW_TITLE_MAX` with its terminator.
+static void setTitle(RudeDrawerCommand& command, std::string const& title) noexcept(true)
+{
+    std::memset(command.windowTitle, 0, sizeof(command.windowTitle));
+    std::memcpy(command.windowTitle, title.c_str(), std::min(title.size(), (size_t)WINDOW_TITLE_MAX - 1));
 }
 
-uint32_t Draw::addWindow(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating) noexcept(false)
+uint32_t Draw::addWindow(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating, uint32_t bufferCount) noexcept(false)
 {
     RudeDrawerCommand command;
     command.kind = RDCMD_ADD_WIN;
     command.windowDims = dims;
-    std::memset(command.windowTitle, 0, WINDOW_TITLE_MAX);
-    std::memcpy(command.windowTitle, title.c_str(), title.size());
-    send(&command, sizeof(RudeDrawerCommand));
-
-    RudeDrawerResponse response;
-    recv(&response, sizeof(RudeDrawerResponse));
+    command.windowAlwaysUpdating = alwaysUpdating;
+    command.windowBufferCount = bufferCount;
+    setTitle(command, title);
+    auto response = request(&command);
 
     NOTOK(response);
 
@@ -102,35 +388,32 @@ uint32_t Draw::addWindow(std::string title, RudeDrawerVec2D dims, bool alwaysUpd
 
     auto id = response.windowId;
 
-    if (alwaysUpdating) {
-        std::thread thread([&callbacks = m_callbacks, id] {
-            DrawCallback* callback = NULL;
-            {
-                auto it = callbacks.find(id);
-                if (it != callbacks.end()) {
-                    callback = it->second;
-                }
-            }
+    if (alwaysUpdating)
+        m_alwaysUpdatingWindows.insert(id);
 
-            auto shouldQuit = false;
-            while (!shouldQuit) {
-                if (callback == NULL) {
-                    auto it = callbacks.find(id);
-                    if (it != callbacks.end()) {
-                        callback = it->second;
-                    }
-                } else {
-                    (callback->callback)(callback->parameters);
-                    shouldQuit = callback->shouldQuit;
-                }
-            }
+    return id;
+}
 
-            callback->running = false;
-        });
-        thread.detach();
-    }
+DrawSurface Draw::createSurface(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating,
+    uint32_t bufferCount, bool sharedMemory) noexcept(false)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_CREATE_SURFACE;
+    command.windowDims = dims;
+    command.windowAlwaysUpdating = alwaysUpdating;
+    command.windowBufferCount = bufferCount;
+    command.windowEventsSharedMemory = sharedMemory;
+    setTitle(command, title);
+    auto response = request(&command);
 
-    return id;
+    expectResponse(response, RDRESP_SURFACE, "createSurface");
+
+    auto id = response.windowId;
+    if (alwaysUpdating)
+        m_alwaysUpdatingWindows.insert(id);
+
+    openEvents(id, sharedMemory, response);
+    return DrawSurface { id, openDisplay(id, dims, response) };
 }
 
 void Draw::setPaintCallback(uint32_t id, DrawCallbackFunction callback, void* params) noexcept(true)
@@ -139,6 +422,26 @@ void Draw::setPaintCallback(uint32_t id, DrawCallbackFunction callback, void* pa
     paintCallback->callback = callback;
     paintCallback->parameters = params;
     m_callbacks[id] = paintCallback;
+
+    if (!m_alwaysUpdatingWindows.contains(id))
+        return;
+
+    paintCallback->thread = std::thread([paintCallback] {
+        std::unique_lock<std::mutex> lock(paintCallback->mutex);
+        while (true) {
+            paintCallback->frameReady.wait(lock, [&] {
+                return paintCallback->framePending || paintCallback->shouldQuit;
+            });
+            if (paintCallback->shouldQuit)
+                break;
+
+            // Frames that arrived while painting collapse into the next one
+            paintCallback->framePending = false;
+            lock.unlock();
+            (paintCallback->callback)(paintCallback->parameters);
+            lock.lock();
+        }
+    });
 }
 
 void Draw::removePaintCallback(uint32_t id) noexcept(true)
@@ -153,10 +456,15 @@ void Draw::removePaintCallback(uint32_t id) noexcept(true)
         }
     }
 
-    callback->shouldQuit = true;
+    {
+        std::lock_guard<std::mutex> guard(callback->mutex);
+        callback->shouldQuit = true;
+    }
+    callback->frameReady.notify_one();
 
     // Wait for the callback to exit
-    while (callback->running) asm("nop");
+    if (callback->thread.joinable())
+        callback->thread.join();
 
     delete callback;
     m_callbacks.erase(id);
@@ -167,28 +475,62 @@ void Draw::removeWindow(uint32_t id) noexcept(false)
     RudeDrawerCommand command;
     command.kind = RDCMD_REMOVE_WIN;
     command.windowId = id;
-    send(&command, sizeof(RudeDrawerCommand));
-
-    RudeDrawerResponse response;
-    recv(&response, sizeof(RudeDrawerResponse));
+    auto response = request(&command);
 
     NOTOK(response);
 
     removePaintCallback(id);
 }
 
-void Draw::startPollingEventsWindow(uint32_t id) noexcept(false)
+void Draw::startPollingEventsWindow(uint32_t id, bool sharedMemory) noexcept(false)
 {
     RudeDrawerCommand command;
-    command.kind = RDCMD_START_POLLING_EVENTS_WIN;
+    command.kind = sharedMemory ? RDCMD_START_POLLING_EVENTS_SHM_WIN : RDCMD_START_POLLING_EVENTS_WIN;
     command.windowId = id;
-    send(&command, sizeof(RudeDrawerCommand));
-
-    RudeDrawerResponse response;
-    recv(&response, sizeof(RudeDrawerResponse));
+    auto response = request(&command);
 
     NOTOK(response);
 
+    openEvents(id, sharedMemory, response);
+}
+
+void Draw::openEvents(uint32_t id, bool sharedMemory, RudeDrawerResponse const& response) noexcept(false)
+{
+    // Surfaces come with their events, other windows only with their queue
+    auto surface = response.kind == RDRESP_SURFACE;
+
+    if (sharedMemory) {
+        if (response.kind != RDRESP_SHM_NAME && !surface) {
+            throw std::runtime_error("ERROR: response is not of kind `RDRESP_SHM_NAME`");
+        }
+
+        std::cout << "[INFO] Mapping event queue of window of ID `"
+                  << id << "`...\n";
+
+        auto shmFd = surface ? response.eventFd : response.shmFd;
+        auto queue = mmap(NULL, sizeof(RudeDrawerEventQueue), PROT_READ | PROT_WRITE,
+            MAP_SHARED, shmFd, 0);
+        if (queue == MAP_FAILED) {
+            std::ostringstream error;
+            error << "ERROR: could not mmap event queue for window of ID `"
+                  << id << "`: " << strerror(errno);
+            close(shmFd);
+            throw std::runtime_error(error.str());
+        }
+
+        m_eventQueues[id] = DrawEventQueue {
+            .queue = (RudeDrawerEventQueue*)queue,
+            .shmFd = shmFd,
+        };
+        return;
+    }
+
+    if (surface) {
+        m_eventSockets[id] = response.eventFd;
+        m_eventBuffers[id] = DrawEventBuffer { };
+        return;
+    }
+
     std::cout << "[INFO] Connecting to event socket of window of ID `"
               << id << "`...\n";
 
@@ -216,6 +558,7 @@ void Draw::startPollingEventsWindow(uint32_t id) noexcept(false)
     }
 
     m_eventSockets[id] = eventSocket;
+    m_eventBuffers[id] = DrawEventBuffer { };
 }
 
 void Draw::stopPollingEventsWindow(uint32_t id) noexcept(false)
@@ -223,16 +566,26 @@ void Draw::stopPollingEventsWindow(uint32_t id) noexcept(false)
     RudeDrawerCommand command;
     command.kind = RDCMD_STOP_POLLING_EVENTS_WIN;
     command.windowId = id;
-    send(&command, sizeof(RudeDrawerCommand));
-
-    RudeDrawerResponse response;
-    recv(&response, sizeof(RudeDrawerResponse));
+    auto response = request(&command);
 
     NOTOK(response);
 
+    closeEvents(id);
+}
+
+void Draw::closeEvents(uint32_t id) noexcept(true)
+{
     auto it = m_eventSockets.find(id);
     if (it != m_eventSockets.end())
         close(m_eventSockets[id]);
+    m_eventBuffers.erase(id);
+
+    auto queueIt = m_eventQueues.find(id);
+    if (queueIt != m_eventQueues.end()) {
+        munmap(queueIt->second.queue, sizeof(RudeDrawerEventQueue));
+        close(queueIt->second.shmFd);
+        m_eventQueues.erase(queueIt);
+    }
 }
 
 void Draw::sendPaintEvent(uint32_t id) noexcept(false)
@@ -240,70 +593,298 @@ void Draw::sendPaintEvent(uint32_t id) noexcept(false)
     RudeDrawerCommand command;
     command.kind = RDCMD_SEND_PAINT_EVENT;
     command.windowId = id;
-    send(&command, sizeof(RudeDrawerCommand));
+
+    std::lock_guard<std::mutex> guard(m_socketMutex);
+    post(&command);
 }
 
 RudeDrawerVec2D Draw::getMousePosition(uint32_t id) noexcept(false)
+{
+    return getMousePositionAsync(id).get();
+}
+
+std::future<RudeDrawerVec2D> Draw::getMousePositionAsync(uint32_t id) noexcept(false)
 {
     RudeDrawerCommand command;
     command.kind = RDCMD_GET_MOUSE_POSITION;
     command.windowId = id;
-    send(&command, sizeof(RudeDrawerCommand));
+    return requestAsync<RudeDrawerVec2D>(&command, [](RudeDrawerResponse const& response) {
+        expectResponse(response, RDRESP_MOUSE_POSITION, "getMousePosition");
+        return response.mousePos;
+    });
+}
+
+RudeDrawerVec2D Draw::getMouseDelta() noexcept(false)
+{
+    return getMouseDeltaAsync().get();
+}
+
+std::future<RudeDrawerVec2D> Draw::getMouseDeltaAsync() noexcept(false)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_GET_MOUSE_DELTA;
+    return requestAsync<RudeDrawerVec2D>(&command, [](RudeDrawerResponse const& response) {
+        expectResponse(response, RDRESP_MOUSE_DELTA, "getMouseDelta");
+        return response.mouseDelta;
+    });
+}
+
+RudeDrawerStats Draw::getStats() noexcept(false)
+{
+    return getStatsAsync().get();
+}
+
+std::future<RudeDrawerStats> Draw::getStatsAsync() noexcept(false)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_GET_STATS;
+    return requestAsync<RudeDrawerStats>(&command, [](RudeDrawerResponse const& response) {
+        expectResponse(response, RDRESP_STATS, "getStats");
+        return response.stats;
+    });
+}
 
-    RudeDrawerResponse response;
-    recv(&response, sizeof(RudeDrawerResponse));
+Display* Draw::getDisplay(uint32_t id, RudeDrawerVec2D dims) noexcept(false)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_GET_DISPLAY_SHM_WIN;
+    command.windowId = id;
+    auto response = request(&command);
 
     NOTOK(response);
 
-    if (response.kind != RDRESP_MOUSE_POSITION) {
-        throw std::runtime_error("ERROR: response is not of kind `RDRESP_MOUSE_POSITION`");
+    return openDisplay(id, dims, response);
+}
+
+Display* Draw::openDisplay(uint32_t id, RudeDrawerVec2D dims, RudeDrawerResponse const& response) noexcept(false)
+{
+    if (response.kind != RDRESP_SHM_NAME && response.kind != RDRESP_SURFACE) {
+        throw std::runtime_error("ERROR: response is not of kind `RDRESP_SHM_NAME`");
     }
 
-    return response.mousePos;
+    auto display = new Display(this, response.shmFd, dims.x, dims.y, id,
+        response.windowBufferCount, response.windowBufferIndex);
+    return display;
+}
+
+uint32_t Draw::commit(uint32_t id) noexcept(false)
+{
+    return commitAsync(id).get();
 }
 
-RudeDrawerVec2D Draw::getMouseDelta() noexcept(false)
+std::future<uint32_t> Draw::commitAsync(uint32_t id) noexcept(false)
 {
     RudeDrawerCommand command;
-    command.kind = RDCMD_GET_MOUSE_DELTA;
-    send(&command, sizeof(RudeDrawerCommand));
-
-    RudeDrawerResponse response;
-    recv(&response, sizeof(RudeDrawerResponse));
+    command.kind = RDCMD_COMMIT_WIN;
+    command.windowId = id;
+    return requestAsync<uint32_t>(&command, [](RudeDrawerResponse const& response) {
+        expectResponse(response, RDRESP_BUFFER_INDEX, "commit");
+        return response.windowBufferIndex;
+    });
+}
 
-    NOTOK(response);
+void Draw::damage(uint32_t id, std::vector<RudeDrawerRect> rects) noexcept(false)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_DAMAGE_WIN;
+    command.windowId = id;
 
-    if (response.kind != RDRESP_MOUSE_DELTA) {
-        throw std::runtime_error("ERROR: response is not of kind `RDRESP_MOUSE_DELTA`");
+    std::lock_guard<std::mutex> guard(m_socketMutex);
+    for (size_t i = 0; i < rects.size(); i += DAMAGE_RECTS_MAX) {
+        auto count = std::min(rects.size() - i, (size_t)DAMAGE_RECTS_MAX);
+        std::memcpy(command.damageRects, rects.data() + i, count * sizeof(RudeDrawerRect));
+        command.damageRectsCount = count;
+        post(&command);
     }
+}
 
-    return response.mouseDelta;
+uint32_t Draw::Batch::add(RudeDrawerCommand const& command, bool alwaysUpdating,
+    RudeDrawerVec2D dims) noexcept(true)
+{
+    auto index = (uint32_t)m_entries.size();
+    encodeCommand(command, index, m_commands);
+    auto eventsSharedMemory = command.kind == RDCMD_CREATE_SURFACE && command.windowEventsSharedMemory;
+    m_entries.push_back(Entry { command.kind, command.windowId, alwaysUpdating, dims, eventsSharedMemory });
+    return index;
 }
 
-Display* Draw::getDisplay(uint32_t id, RudeDrawerVec2D dims) noexcept(false)
+uint32_t Draw::Batch::addWindow(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating,
+    uint32_t bufferCount) noexcept(true)
 {
     RudeDrawerCommand command;
-    command.kind = RDCMD_GET_DISPLAY_SHM_WIN;
+    command.kind = RDCMD_ADD_WIN;
+    command.windowId = 0;
+    command.windowDims = dims;
+    command.windowAlwaysUpdating = alwaysUpdating;
+    command.windowBufferCount = bufferCount;
+    setTitle(command, title);
+    return add(command, alwaysUpdating);
+}
+
+uint32_t Draw::Batch::removeWindow(uint32_t id) noexcept(true)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_REMOVE_WIN;
+    command.windowId = id;
+    return add(command);
+}
+
+uint32_t Draw::Batch::startPollingEventsWindow(uint32_t id, bool sharedMemory) noexcept(true)
+{
+    RudeDrawerCommand command;
+    command.kind = sharedMemory ? RDCMD_START_POLLING_EVENTS_SHM_WIN : RDCMD_START_POLLING_EVENTS_WIN;
     command.windowId = id;
-    send(&command, sizeof(RudeDrawerCommand));
+    return add(command);
+}
 
-    RudeDrawerResponse response;
-    recv(&response, sizeof(RudeDrawerResponse));
+uint32_t Draw::Batch::stopPollingEventsWindow(uint32_t id) noexcept(true)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_STOP_POLLING_EVENTS_WIN;
+    command.windowId = id;
+    return add(command);
+}
 
-    NOTOK(response);
+uint32_t Draw::Batch::sendPaintEvent(uint32_t id) noexcept(true)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_SEND_PAINT_EVENT;
+    command.windowId = id;
+    return add(command);
+}
 
-    if (response.kind != RDRESP_SHM_NAME) {
-        throw std::runtime_error("ERROR: response is not of kind `RDRESP_SHM_NAME`");
-    }
+uint32_t Draw::Batch::getDisplay(uint32_t id, RudeDrawerVec2D dims) noexcept(true)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_GET_DISPLAY_SHM_WIN;
+    command.windowId = id;
+    return add(command, false, dims);
+}
 
-    std::string shmName((char*)response.windowShmName);
+uint32_t Draw::Batch::createSurface(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating,
+    uint32_t bufferCount, bool sharedMemory) noexcept(true)
+{
+    RudeDrawerCommand command;
+    command.kind = RDCMD_CREATE_SURFACE;
+    command.windowId = 0;
+    command.windowDims = dims;
+    command.windowAlwaysUpdating = alwaysUpdating;
+    command.windowBufferCount = bufferCount;
+    command.windowEventsSharedMemory = sharedMemory;
+    setTitle(command, title);
+    return add(command, alwaysUpdating, dims);
+}
 
-    auto display = new Display(shmName, dims.x, dims.y, id);
-    return display;
+size_t Draw::Batch::size() const noexcept(true)
+{
+    return m_entries.size();
 }
 
-RudeDrawerEvent Draw::pollEvent(uint32_t id) noexcept(false)
+std::vector<DrawBatchResult> Draw::run(Batch const& batch) noexcept(false)
+{
+    if (m_version < 2)
+        throw std::runtime_error("ERROR: batches need version 2 of the protocol");
+    if (batch.m_entries.size() > BATCH_COMMANDS_MAX || batch.m_commands.size() > MESSAGE_PAYLOAD_MAX)
+        throw std::runtime_error("ERROR: batch is too large");
+
+    // Commands that return nothing keep an empty response
+    RudeDrawerResponse empty;
+    empty.kind = RDRESP_EMPTY;
+    empty.errorKind = RDERROR_OK;
+    auto responses = std::make_shared<std::vector<RudeDrawerResponse>>(batch.m_entries.size(), empty);
+
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+    DrawPending pending;
+    pending.batchResponses = responses.get();
+    pending.completion = [promise, responses](RudeDrawerResponse const* response) {
+        if (response == nullptr) {
+            promise->set_exception(std::make_exception_ptr(
+                std::runtime_error("ERROR: lost the connection to the server")));
+            return;
+        }
+        try {
+            expectResponse(*response, RDRESP_BATCH, "run");
+            promise->set_value();
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    };
+
+    submitPending(std::move(pending), [&] {
+        m_message.clear();
+        RudeDrawerMessageHeader header = { RDCMD_BATCH, 0, nextRequestId(),
+            (uint32_t)batch.m_commands.size() };
+        messageWrite(m_message, &header, sizeof(header));
+        messageWrite(m_message, batch.m_commands.data(), batch.m_commands.size());
+        send(m_message.data(), m_message.size());
+    });
+    future.get();
+
+    // Does what the synchronous versions of the commands do once they succeeded
+    std::vector<DrawBatchResult> results(batch.m_entries.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& entry = batch.m_entries[i];
+        auto& result = results[i];
+        result.response = (*responses)[i];
+        if (result.response.errorKind != RDERROR_OK)
+            continue;
+
+        auto id = entry.windowId;
+        if (id & BATCH_RESULT(0)) {
+            auto index = id & ~BATCH_RESULT(0);
+            id = index < i ? results[index].windowId : 0;
+        }
+
+        switch (entry.kind) {
+        case RDCMD_ADD_WIN:
+            id = result.response.windowId;
+            if (entry.alwaysUpdating)
+                m_alwaysUpdatingWindows.insert(id);
+            break;
+        case RDCMD_REMOVE_WIN:
+            removePaintCallback(id);
+            break;
+        case RDCMD_START_POLLING_EVENTS_WIN:
+        case RDCMD_START_POLLING_EVENTS_SHM_WIN:
+            openEvents(id, entry.kind == RDCMD_START_POLLING_EVENTS_SHM_WIN, result.response);
+            break;
+        case RDCMD_STOP_POLLING_EVENTS_WIN:
+            closeEvents(id);
+            break;
+        case RDCMD_GET_DISPLAY_SHM_WIN:
+            result.display = openDisplay(id, entry.dims, result.response);
+            break;
+        case RDCMD_CREATE_SURFACE:
+            id = result.response.windowId;
+            if (entry.alwaysUpdating)
+                m_alwaysUpdatingWindows.insert(id);
+            openEvents(id, entry.eventsSharedMemory, result.response);
+            result.display = openDisplay(id, entry.dims, result.response);
+            break;
+        default:
+            break;
+        }
+        result.windowId = id;
+    }
+    return results;
+}
+
+RudeDrawerEvent Draw::receiveEvent(uint32_t id) noexcept(false)
 {
+    RudeDrawerEvent event;
+
+    auto queueIt = m_eventQueues.find(id);
+    if (queueIt != m_eventQueues.end()) {
+        auto queue = queueIt->second.queue;
+        while (!eventQueuePop(queue, event)) {
+            if (__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST))
+                throw std::runtime_error("ERROR: server stopped sending events");
+            eventQueueWait(queue);
+        }
+        return event;
+    }
+
     auto it = m_eventSockets.find(id);
     if (it == m_eventSockets.end()) {
         std::ostringstream error;
@@ -311,22 +892,58 @@ RudeDrawerEvent Draw::pollEvent(uint32_t id) noexcept(false)
         throw std::runtime_error(error.str());
     }
     auto eventSocket = it->second;
+    auto& buffer = m_eventBuffers[id];
+
+    while (buffer.end - buffer.begin < sizeof(RudeDrawerEvent)) {
+        // Keep the start of a partially received event
+        std::memmove(buffer.data, buffer.data + buffer.begin, buffer.end - buffer.begin);
+        buffer.end -= buffer.begin;
+        buffer.begin = 0;
+
+        auto numOfBytesRecvd = ::recv(eventSocket, buffer.data + buffer.end, sizeof(buffer.data) - buffer.end, 0);
+        if (numOfBytesRecvd < 0) {
+            std::ostringstream error;
+            error << "ERROR: could not receive data from server: "
+                  << strerror(errno);
+            close(eventSocket);
+            throw std::runtime_error(error.str());
+        }
+        if (numOfBytesRecvd == 0) {
+            close(eventSocket);
+            throw std::runtime_error("ERROR: server closed the event socket");
+        }
+        buffer.end += numOfBytesRecvd;
+    }
 
+    std::memcpy(&event, buffer.data + buffer.begin, sizeof(RudeDrawerEvent));
+    buffer.begin += sizeof(RudeDrawerEvent);
+    return event;
+}
+
+RudeDrawerEvent Draw::pollEvent(uint32_t id) noexcept(false)
+{
     RudeDrawerEvent event;
-    auto numOfBytesRecvd = ::recv(eventSocket, &event, sizeof(RudeDrawerEvent), 0);
-    if (numOfBytesRecvd < 0) {
-        std::ostringstream error;
-        error << "ERROR: could not receive data from server: "
-              << strerror(errno);
-        close(eventSocket);
-        throw std::runtime_error(error.str());
-    }
+    do {
+        event = receiveEvent(id);
+
+        // Frame events only wake up the paint thread, they never reach the client
+        if (event.kind == RDEVENT_FRAME) {
+            auto it = m_callbacks.find(id);
+            if (it != m_callbacks.end()) {
+                {
+                    std::lock_guard<std::mutex> guard(it->second->mutex);
+                    it->second->framePending = true;
+                }
+                it->second->frameReady.notify_one();
+            }
+        }
+    } while (event.kind == RDEVENT_FRAME);
 
     if (event.kind == RDEVENT_PAINT) {
         auto it = m_callbacks.find(id);
         if (it != m_callbacks.end()) {
             (it->second->callback)(it->second->parameters);
-            RudeDrawerEvent retval;
+            RudeDrawerEvent retval = { };
             retval.kind = RDEVENT_NONE;
             return retval;
         }
@@ -337,5 +954,16 @@ RudeDrawerEvent Draw::pollEvent(uint32_t id) noexcept(false)
 Draw::~Draw() noexcept(true)
 {
     std::cout << "[INFO] Closing connection\n";
+    {
+        std::lock_guard<std::mutex> guard(m_pendingMutex);
+        m_disconnected = true;
+    }
+    // Wakes up the receiver, that fails whatever is still pending
+    shutdown(m_socket, SHUT_RDWR);
+    if (m_receiver.joinable())
+        m_receiver.join();
     close(m_socket);
+    for (auto fd : m_receivedFds) {
+        close(fd);
+    }
 }
@@ -1,19 +1,34 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
-#include <string>
 
 // Display.h - Defines the `Display` class.
 
+class Draw;
+
 class Display {
 private:
+    Draw* m_draw;
     int m_pixelsShmFd;
-    int m_pixelsShmSize;
+    size_t m_pixelsShmSize;
     uint32_t m_windowId;
+    // All the buffers of the window, back to back.
+    uint8_t* m_buffers;
+    size_t m_bufferSize;
+    uint32_t m_bufferCount;
+    uint32_t m_backBuffer;
 public:
-    // A pointer to RGBA data.
+    // A pointer to RGBA data. For windows with more than one buffer, this is the
+    // back buffer, and it changes after every `commit()`.
     uint8_t* m_pixels;
 
-    Display(std::string name, uint32_t width, uint32_t height, uint32_t id) noexcept(false);
+    // Maps the buffers of the window from `shmFd`, that it owns from then on.
+    Display(Draw* draw, int shmFd, uint32_t width, uint32_t height, uint32_t id,
+        uint32_t bufferCount, uint32_t backBuffer) noexcept(false);
+    // Shows what was drawn into `m_pixels` and moves `m_pixels` to the next back buffer,
+    // which can still hold the contents of an older frame.
+    void commit() noexcept(false);
+    uint32_t bufferCount() noexcept(true);
     void destroy() noexcept(false);
 };
@@ -1,8 +1,17 @@
 #pragma once
 
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "RudeDrawer.h"
 #include "Display.h"
@@ -13,27 +22,163 @@ typedef void (*DrawCallbackFunction)(void*);
 struct DrawCallback {
     DrawCallbackFunction callback;
     void* parameters;
-    bool running = true;
+
+    // Windows that are always updating call `callback` on `thread`, once
+    // per `RDEVENT_FRAME` received by `Draw::pollEvent()`.
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    bool framePending = false;
     bool shouldQuit = false;
 };
 
+// The event queue of a window that polls events through shared memory.
+struct DrawEventQueue {
+    RudeDrawerEventQueue* queue;
+    int shmFd;
+};
+
+// Events received from the event socket of a window that `Draw::pollEvent()` did
+// not return yet. The server sends whatever is pending at once, and it is all
+// received at once.
+#define DRAW_EVENT_BUFFER_SIZE 64
+struct DrawEventBuffer {
+    uint8_t data[DRAW_EVENT_BUFFER_SIZE * sizeof(RudeDrawerEvent)];
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+// Called with the response to a command, or with `nullptr` if the connection to the
+// server was lost before it arrived.
+typedef std::function<void(RudeDrawerResponse const*)> DrawCompletion;
+
+// A command waiting for its response.
+struct DrawPending {
+    DrawCompletion completion;
+    // For batches, filled with the responses to their commands before `completion`
+    // is called with the `RDRESP_BATCH`.
+    std::vector<RudeDrawerResponse>* batchResponses = nullptr;
+};
+
+// A window added by `Draw::createSurface()`.
+struct DrawSurface {
+    uint32_t id;
+    Display* display;
+};
+
+// The outcome of a command of a `Draw::Batch`.
+struct DrawBatchResult {
+    // The response of the server. Commands that return nothing get an empty one.
+    RudeDrawerResponse response;
+    // The window the command added or was about, 0 if it failed.
+    uint32_t windowId = 0;
+    // The display returned by `Draw::Batch::getDisplay()` or `Draw::Batch::createSurface()`.
+    Display* display = nullptr;
+};
+
 // This class is used for communication with the AppDrawer server.
 class Draw {
+public:
+    // Commands that the server runs at once, with `Draw::run()`. Every function adds a
+    // command and returns its index in the batch, so that later commands can refer to
+    // its window with `BATCH_RESULT(index)` instead of an ID.
+    class Batch {
+        friend class Draw;
+
+    private:
+        struct Entry {
+            RudeDrawerCommandKind kind;
+            uint32_t windowId;
+            bool alwaysUpdating;
+            RudeDrawerVec2D dims;
+            bool eventsSharedMemory;
+        };
+
+        // The framed commands, the payload of the `RDCMD_BATCH`
+        std::vector<uint8_t> m_commands;
+        std::vector<Entry> m_entries;
+
+        uint32_t add(RudeDrawerCommand const& command, bool alwaysUpdating = false,
+            RudeDrawerVec2D dims = { }) noexcept(true);
+
+    public:
+        uint32_t addWindow(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating, uint32_t bufferCount = 1) noexcept(true);
+        uint32_t removeWindow(uint32_t id) noexcept(true);
+        uint32_t startPollingEventsWindow(uint32_t id, bool sharedMemory = false) noexcept(true);
+        uint32_t stopPollingEventsWindow(uint32_t id) noexcept(true);
+        uint32_t sendPaintEvent(uint32_t id) noexcept(true);
+        uint32_t getDisplay(uint32_t id, RudeDrawerVec2D dims) noexcept(true);
+        uint32_t createSurface(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating,
+            uint32_t bufferCount = 1, bool sharedMemory = false) noexcept(true);
+        size_t size() const noexcept(true);
+    };
+
 private:
-    int m_socket;
+    int m_socket = -1;
+    // The version of the protocol agreed on with the server, see `PROTOCOL_VERSION`.
+    uint32_t m_version = 1;
+    uint32_t m_nextRequestId = 1;
+    std::vector<uint8_t> m_message;
+    // Shared memories received along with responses, not given to one yet. Only
+    // used by `m_receiver`.
+    std::deque<int> m_receivedFds;
+    // Commands waiting for their response, by request ID. Responses are received
+    // by `m_receiver`, in whatever order the server sends them.
+    std::mutex m_pendingMutex;
+    std::map<uint32_t, DrawPending> m_pending;
+    bool m_disconnected = false;
+    std::thread m_receiver;
     std::unordered_map<uint32_t, DrawCallback*> m_callbacks;
     std::unordered_map<uint32_t, int> m_eventSockets;
+    std::unordered_map<uint32_t, DrawEventBuffer> m_eventBuffers;
+    std::unordered_map<uint32_t, DrawEventQueue> m_eventQueues;
+    std::unordered_set<uint32_t> m_alwaysUpdatingWindows;
+    // Keeps commands and their responses from interleaving, as `Display::commit()`
+    // is usually called from a paint callback.
+    std::mutex m_socketMutex;
 
-    void send(void* data, int n) noexcept(false);
+    void send(void const* data, int n) noexcept(false);
+    // Receives exactly `n` bytes, and the file descriptors that come along with them.
     void recv(void* data, int n) noexcept(false);
+    int popReceivedFd() noexcept(false);
+    // Gives `response` the file descriptors received along with it, if it has any.
+    void takeReceivedFds(RudeDrawerResponse& response) noexcept(false);
+    uint32_t nextRequestId() noexcept(true);
+    // Sends a command, framed if the server speaks version 2. Returns its request ID.
+    uint32_t post(RudeDrawerCommand* command) noexcept(false);
+    // Registers `pending` for the command that `post` sends.
+    template<typename F>
+    void submitPending(DrawPending pending, F&& post) noexcept(false);
+    RudeDrawerResponse request(RudeDrawerCommand* command) noexcept(false);
+    // Receives responses until the connection is closed.
+    void receiveResponses() noexcept(true);
+    // Sends a command whose response becomes the value of the returned future,
+    // through `extract`, which can throw.
+    template<typename T, typename F>
+    std::future<T> requestAsync(RudeDrawerCommand* command, F&& extract) noexcept(false);
+    // Blocks until the server sends an event to a window.
+    RudeDrawerEvent receiveEvent(uint32_t id) noexcept(false);
+    // What the client does once the server started or stopped sending events to a
+    // window, or returned its display.
+    void openEvents(uint32_t id, bool sharedMemory, RudeDrawerResponse const& response) noexcept(false);
+    void closeEvents(uint32_t id) noexcept(true);
+    Display* openDisplay(uint32_t id, RudeDrawerVec2D dims, RudeDrawerResponse const& response) noexcept(false);
 public:
-    // Connects to the AppDrawer server.
-    void connect() noexcept(false);
+    // Connects to the AppDrawer server, and agrees on the version of the protocol.
+    // `version` 1 sends commands as fixed-size `RudeDrawerCommand`s.
+    void connect(uint32_t version = PROTOCOL_VERSION) noexcept(false);
     // Makes the server print `Pong!` in its logs.
     void ping() noexcept(false);
-    // Adds a window.
-    uint32_t addWindow(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating) noexcept(false);
+    // Adds a window. Windows with 2 or 3 buffers (see `WINDOW_BUFFERS_MAX`) only
+    // show what was committed with `Display::commit()`.
+    uint32_t addWindow(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating, uint32_t bufferCount = 1) noexcept(false);
+    // Adds a window, returns its display and starts polling its events, in a single
+    // round trip instead of one for each of these.
+    DrawSurface createSurface(std::string title, RudeDrawerVec2D dims, bool alwaysUpdating,
+        uint32_t bufferCount = 1, bool sharedMemory = false) noexcept(false);
     // Sets the callback that will be called everytime a window needs to be updated.
+    // For windows that are always updating, it is called on a separate thread
+    // once per frame of the server, as long as the window is polling events.
     void setPaintCallback(uint32_t id, DrawCallbackFunction callback, void* params) noexcept(true);
     // Removes the callback set by `Draw::setWindowCallback()`.
     // Not removing the callback can lead to undefined behavior.
@@ -41,7 +186,9 @@ public:
     // Removes a window.
     void removeWindow(uint32_t id) noexcept(false);
     // Makes the server start sending events to the client.
-    void startPollingEventsWindow(uint32_t id) noexcept(false);
+    // With `sharedMemory`, the server writes events to a queue in shared memory instead
+    // of a socket, so that `pollEvent()` only makes a system call when it has to wait.
+    void startPollingEventsWindow(uint32_t id, bool sharedMemory = false) noexcept(false);
     // Makes the server stop sending events to the client.
     void stopPollingEventsWindow(uint32_t id) noexcept(false);
     // Makes the server send a paint event to the specified window.
@@ -50,10 +197,35 @@ public:
     RudeDrawerVec2D getMousePosition(uint32_t id) noexcept(false);
     // Returns the mouse position delta between frames.
     RudeDrawerVec2D getMouseDelta() noexcept(false);
+    // Returns how long the phases of the server's most recent frames took.
+    RudeDrawerStats getStats() noexcept(false);
     // Returns a `Display` instance (defined and documented in `Display.h`).
     Display* getDisplay(uint32_t id, RudeDrawerVec2D dims) noexcept(false);
+    // Reports which regions of a window changed since the last frame, so that the
+    // server only uploads those. Rectangles are in window coordinates.
+    void damage(uint32_t id, std::vector<RudeDrawerRect> rects) noexcept(false);
+    // Shows the buffer the client has been drawing into, and returns the index of
+    // the next one. Prefer `Display::commit()`.
+    uint32_t commit(uint32_t id) noexcept(false);
     // Returns a `RudeDrawerEvent` struct (defined and documented in `RudeDrawer.h`).
     RudeDrawerEvent pollEvent(uint32_t id) noexcept(false);
 
+    // Sends any command that returns a response, without waiting for it. Any number
+    // of commands can be waiting for their response at once. `completion` is called on
+    // the thread receiving responses, so it must not wait for another response.
+    void submit(RudeDrawerCommand* command, DrawCompletion completion) noexcept(false);
+    std::future<RudeDrawerResponse> submit(RudeDrawerCommand* command) noexcept(false);
+    // Like their synchronous versions, without waiting for the response.
+    std::future<void> pingAsync() noexcept(false);
+    std::future<RudeDrawerVec2D> getMousePositionAsync(uint32_t id) noexcept(false);
+    std::future<RudeDrawerVec2D> getMouseDeltaAsync() noexcept(false);
+    std::future<RudeDrawerStats> getStatsAsync() noexcept(false);
+    std::future<uint32_t> commitAsync(uint32_t id) noexcept(false);
+
+    // Runs the commands of `batch` at once, and returns their outcomes in the same
+    // order. Only throws if the batch itself could not run: failed commands have the
+    // error in their response. Needs version 2 of the protocol.
+    std::vector<DrawBatchResult> run(Batch const& batch) noexcept(false);
+
     ~Draw() noexcept(true);
 };
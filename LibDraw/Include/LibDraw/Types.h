@@ -3,3 +3,4 @@
 #include "RudeDrawer.h"
 
 typedef RudeDrawerVec2D DrawVec2D;
+typedef RudeDrawerRect DrawRect;
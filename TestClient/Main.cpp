@@ -24,6 +24,7 @@ typedef struct {
     int* rectY;
     int* rectDirY;
     Olivec_Canvas canvas;
+    Display* display;
     DrawVec2D dims;
 } CallbackParameters;
 
@@ -39,7 +40,7 @@ int main() noexcept(true)
     };
 
     uint32_t id;
-    TRY(id = draw.addWindow("Test Client", dims, true));
+    TRY(id = draw.addWindow("Test Client", dims, true, 2));
     std::cout << "Window ID: " << id << "\n";
 
     Display* display = nullptr;
@@ -60,11 +61,13 @@ int main() noexcept(true)
         .rectY = &rectY,
         .rectDirY = &rectDirY,
         .canvas = canvas,
+        .display = display,
         .dims = dims,
     };
 
     draw.setPaintCallback(id, [](void* p) {
         auto params = (CallbackParameters*)p;
+        params->canvas.pixels = (uint32_t*)params->display->m_pixels;
         olivec_fill(params->canvas, 0xFF181818);
 
         if (*params->rectX + RECT_WIDTH >= params->dims.x || *params->rectX <= 0)
@@ -77,6 +80,8 @@ int main() noexcept(true)
 
         olivec_rect(params->canvas, *params->rectX, *params->rectY,
                     RECT_WIDTH, RECT_HEIGHT, 0xFF00FFFF);
+
+        TRY(params->display->commit());
     }, &params);
 
     TRY(draw.startPollingEventsWindow(id));
@@ -95,18 +100,15 @@ int main() noexcept(true)
             if (event.key == RDKEY_SPACE) {
                 RudeDrawerVec2D delta;
                 TRY(delta = draw.getMouseDelta());
-                RudeDrawerVec2D pos;
-                TRY(pos = draw.getMousePosition(id));
                 std::cout << "Mouse delta: {" << delta.x << ", " << delta.y << "}\n";
-                std::cout << "Mouse position: {" << pos.x << ", " << pos.y << "}\n";
+                std::cout << "Mouse position: {" << event.mousePos.x << ", " << event.mousePos.y << "}\n";
             } else {
                 std::cout << "Key pressed! " << event.key << "\n";
             }
             break;
         case RDEVENT_MOUSEPRESS:
             if (event.mouseButton == RDMOUSE_LEFT) {
-                RudeDrawerVec2D pos;
-                TRY(pos = draw.getMousePosition(id));
+                auto pos = event.mousePos;
                 auto withinRectangleX = pos.x >= rectX && pos.x < (rectX + RECT_WIDTH);
                 auto withinRectangleY = pos.y >= rectY && pos.y < (rectY + RECT_HEIGHT);
                 if (withinRectangleX && withinRectangleY) {